@@ -0,0 +1,372 @@
+/**
+ * confile_bench
+ * throughput and allocations of encoding, decoding, json conversion and the codecs,
+ * on a generated corpus, written out as json so runs can be compared
+ *
+ *     confile_bench [--scale N] [--repeat N] [--filter TEXT] [--out FILE]
+ *
+ * --scale multiplies the size of every corpus document (default 1, a few MB of json each),
+ * --repeat is how often every benchmark runs (the fastest run counts), --filter only runs
+ * benchmarks whose name contains TEXT and --out writes the results to FILE instead of stdout
+ */
+
+#include "confile.h"
+
+#include <chrono>
+#include <new>
+
+// every allocation goes through these, so each benchmark can count its own
+static std::atomic<uint64_t> allocations = 0;
+static std::atomic<uint64_t> allocatedBytes = 0;
+
+// malloc and free stay out of line, otherwise gcc sees them inlined at every new/delete pair
+// and reports them as mismatched (-Wmismatched-new-delete)
+[[gnu::noinline]] static void* benchAllocate(size_t size, size_t align) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    if (align <= alignof(std::max_align_t)) {
+        return std::malloc(size ? size : 1);
+    }
+    return std::aligned_alloc(align, (size + align - 1) / align * align);
+}
+
+[[gnu::noinline]] static void benchFree(void* p) {
+    std::free(p);
+}
+
+void* operator new(size_t size) {
+    if (void* p = benchAllocate(size, 0)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+// std::pmr::new_delete_resource (the default resource of the trees) asks for aligned memory
+void* operator new(size_t size, std::align_val_t alignment) {
+    if (void* p = benchAllocate(size, std::max((size_t)alignment, sizeof(void*)))) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    benchFree(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    benchFree(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    benchFree(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+    benchFree(p);
+}
+
+// deterministic, so every run sees the same corpus
+struct BenchRandom {
+    uint64_t state;
+
+    uint64_t next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+
+    uint64_t below(uint64_t bound) {
+        return next() % bound;
+    }
+
+    // text made of a small vocabulary, compressible like real strings are
+    std::string words(size_t count) {
+        const static char* vocabulary[] = {"lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit",
+            "sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore", "et", "dolore", "magna", "aliqua"};
+        std::string text;
+        for (size_t i = 0; i < count; i++) {
+            if (i) {
+                text += ' ';
+            }
+            text += vocabulary[below(std::size(vocabulary))];
+        }
+        return text;
+    }
+};
+
+// an array of small records, like a table exported to json
+ConValue benchFlat(BenchRandom& random, size_t scale) {
+    ConValue value = ConArray();
+    for (size_t i = 0; i < 20000 * scale; i++) {
+        ConValue record = ConObject();
+        ConObject& fields = *record.object;
+        fields["id"] = ConValue((int64_t)i);
+        fields["name"] = ConValue(std::pmr::string(random.words(2)));
+        fields["email"] = ConValue(std::pmr::string("user" + std::to_string(random.below(100000)) + "@example.com"));
+        fields["active"] = ConValue(random.below(2) == 1);
+        fields["score"] = ConValue((double)random.below(100000) / 100);
+        ConValue tags = ConArray();
+        for (size_t k = random.below(4); k > 0; k--) {
+            tags.array->values.emplace_back(std::pmr::string(random.words(1)));
+        }
+        fields["tags"] = std::move(tags);
+        value.array->values.push_back(std::move(record));
+    }
+    return value;
+}
+
+// objects nested a few hundred levels deep
+ConValue benchDeep(BenchRandom& random, size_t scale) {
+    ConValue value = ConArray();
+    for (size_t chain = 0; chain < 200 * scale; chain++) {
+        ConValue node = ConValue(std::pmr::string(random.words(3)));
+        for (size_t depth = 0; depth < 256; depth++) {
+            ConValue parent = ConObject();
+            (*parent.object)["level"] = ConValue((int64_t)depth);
+            (*parent.object)["child"] = std::move(node);
+            node = std::move(parent);
+        }
+        value.array->values.push_back(std::move(node));
+    }
+    return value;
+}
+
+// a few objects with a lot of keys each
+ConValue benchWide(BenchRandom& random, size_t scale) {
+    ConValue value = ConArray();
+    for (size_t i = 0; i < 4 * scale; i++) {
+        ConValue object = ConObject();
+        for (size_t k = 0; k < 25000; k++) {
+            (*object.object)["key_" + std::to_string(random.next() % 1000000) + "_" + std::to_string(k)] = ConValue((int64_t)random.below(1000));
+        }
+        value.array->values.push_back(std::move(object));
+    }
+    return value;
+}
+
+// long arrays of integers and floats
+ConValue benchNumeric(BenchRandom& random, size_t scale) {
+    ConValue value = ConObject();
+    ConValue integers = ConArray();
+    ConValue floats = ConArray();
+    int64_t counter = 0;
+    for (size_t i = 0; i < 150000 * scale; i++) {
+        counter += random.below(16);
+        integers.array->values.emplace_back(counter);
+        floats.array->values.emplace_back((double)random.below(1 << 20) / 1024);
+    }
+    (*value.object)["integers"] = std::move(integers);
+    (*value.object)["floats"] = std::move(floats);
+    return value;
+}
+
+// a few large strings
+ConValue benchStrings(BenchRandom& random, size_t scale) {
+    ConValue value = ConArray();
+    for (size_t i = 0; i < 8 * scale; i++) {
+        value.array->values.emplace_back(std::pmr::string(random.words(80000)));
+    }
+    return value;
+}
+
+// how a document is encoded, the ones worth comparing
+struct BenchPolicy {
+    const char* name;
+    ConWriteOptions options;
+};
+
+std::vector<BenchPolicy> benchPolicies() {
+    std::vector<BenchPolicy> policies;
+    policies.push_back({"v0", ConWriteOptions()});
+    ConWriteOptions plain;
+    plain.version = CON_VERSION_LATEST;
+    plain.codec = ConCodecId::None;
+    policies.push_back({"v1-uncompressed", plain});
+    ConWriteOptions indexed = plain;
+    indexed.offsetTable = true;
+    indexed.keyIndex = true;
+    policies.push_back({"v1-indexed", indexed});
+    for (ConCodecId id : {ConCodecId::Zlib, ConCodecId::Zstd, ConCodecId::Lz4}) {
+        const ConCodec* codec = conCodec(id);
+        if (!codec) {
+            continue;
+        }
+        ConWriteOptions compressed;
+        compressed.version = CON_VERSION_LATEST;
+        compressed.codec = id;
+        policies.push_back({codec->name, compressed});
+        ConWriteOptions small = compressed;
+        small.compact = true;
+        small.keyDictionary = true;
+        small.columnar = true;
+        small.packed = true;
+        small.delta = true;
+        small.blockElements = 4096;
+        small.threads = 0;
+        policies.push_back({id == ConCodecId::Zlib ? "zlib-compact" : id == ConCodecId::Zstd ? "zstd-compact" : "lz4-compact", small});
+    }
+    return policies;
+}
+
+struct Bench {
+    size_t repeat = 3;
+    std::string filter;
+    ConValue results = ConArray();
+    // set when a benchmark didn't produce what it should have, the run fails then
+    bool failed = false;
+
+    // runs `run` repeat times, `bytes` is what the throughput is measured against, `output` the size of what it produced
+    // `run` calls fail() if the result is wrong, the benchmark isn't reported then
+    template<typename Run>
+    void measure(const std::string& name, uint64_t bytes, Run run) {
+        if (name.find(filter) == std::string::npos) {
+            return;
+        }
+        double best = 0;
+        uint64_t calls = 0;
+        uint64_t allocated = 0;
+        uint64_t output = 0;
+        for (size_t i = 0; i < repeat; i++) {
+            uint64_t callsBefore = allocations.load();
+            uint64_t bytesBefore = allocatedBytes.load();
+            auto start = std::chrono::steady_clock::now();
+            broken = false;
+            output = run();
+            if (broken) {
+                std::cerr << name << ": failed" << std::endl;
+                failed = true;
+                return;
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (i == 0 || seconds < best) {
+                best = seconds;
+                calls = allocations.load() - callsBefore;
+                allocated = allocatedBytes.load() - bytesBefore;
+            }
+        }
+        ConValue result = ConObject();
+        ConObject& fields = *result.object;
+        fields["name"] = ConValue(std::pmr::string(name));
+        fields["bytes"] = ConValue((int64_t)bytes);
+        fields["output_bytes"] = ConValue((int64_t)output);
+        fields["seconds"] = ConValue(best);
+        fields["mb_per_second"] = ConValue(best > 0 ? bytes / best / 1e6 : 0.0);
+        fields["allocations"] = ConValue((int64_t)calls);
+        fields["allocated_bytes"] = ConValue((int64_t)allocated);
+        results.array->values.push_back(std::move(result));
+        std::cerr << name << ": " << (best > 0 ? bytes / best / 1e6 : 0.0) << " MB/s, " << calls << " allocations" << std::endl;
+    }
+
+    void document(const std::string& corpus, ConValue& value, const std::vector<BenchPolicy>& policies) {
+        std::stringstream text;
+        text << value;
+        std::string json = text.str();
+        // json conversion, both measured against the size of the json
+        measure(corpus + "/json-write", json.size(), [&] {
+            std::stringstream out;
+            out << value;
+            return (uint64_t)out.tellp();
+        });
+        measure(corpus + "/json-read", json.size(), [&] {
+            std::stringstream in(json);
+            ConValue parsed;
+            if (!(in >> parsed)) {
+                fail();
+            }
+            return (uint64_t)json.size();
+        });
+        // encoding is measured against the size of the encoded document
+        for (const BenchPolicy& policy : policies) {
+            std::stringstream encoded;
+            value.write(encoded, policy.options);
+            std::string con = encoded.str();
+            measure(corpus + "/con-write/" + policy.name, con.size(), [&] {
+                std::stringstream out;
+                value.write(out, policy.options);
+                return (uint64_t)out.tellp();
+            });
+            measure(corpus + "/con-read/" + policy.name, con.size(), [&] {
+                std::stringstream in(con);
+                ConValue decoded;
+                decoded.read(in);
+                if (!in) {
+                    fail();
+                }
+                return (uint64_t)con.size();
+            });
+        }
+        // the codecs on their own, on the json text
+        for (ConCodecId id : {ConCodecId::Zlib, ConCodecId::Zstd, ConCodecId::Lz4}) {
+            const ConCodec* codec = conCodec(id);
+            if (!codec || (id == ConCodecId::Lz4 && json.size() > INT32_MAX)) {
+                continue;
+            }
+            std::vector<uint8_t> compressed = codec->compress((const uint8_t*)json.data(), json.size(), CON_LEVEL_DEFAULT, nullptr);
+            measure(corpus + "/compress/" + codec->name, json.size(), [&] {
+                return (uint64_t)codec->compress((const uint8_t*)json.data(), json.size(), CON_LEVEL_DEFAULT, nullptr).size();
+            });
+            measure(corpus + "/decompress/" + codec->name, json.size(), [&] {
+                return (uint64_t)codec->decompress(compressed.data(), compressed.size(), json.size(), nullptr).size();
+            });
+        }
+    }
+
+private:
+    bool broken = false;
+
+    void fail() {
+        broken = true;
+    }
+};
+
+int main(int argc, char** argv) {
+    Bench bench;
+    size_t scale = 1;
+    std::string out;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (i + 1 < argc && arg == "--scale") {
+            scale = std::max(std::atoi(argv[++i]), 1);
+        } else if (i + 1 < argc && arg == "--repeat") {
+            bench.repeat = std::max(std::atoi(argv[++i]), 1);
+        } else if (i + 1 < argc && arg == "--filter") {
+            bench.filter = argv[++i];
+        } else if (i + 1 < argc && arg == "--out") {
+            out = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--scale N] [--repeat N] [--filter TEXT] [--out FILE]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<BenchPolicy> policies = benchPolicies();
+    std::pair<const char*, ConValue (*)(BenchRandom&, size_t)> corpus[] = {
+        {"flat", benchFlat},
+        {"deep", benchDeep},
+        {"wide", benchWide},
+        {"numeric", benchNumeric},
+        {"strings", benchStrings},
+    };
+    for (auto [name, generate] : corpus) {
+        BenchRandom random{0x9e3779b97f4a7c15};
+        ConValue value = generate(random, scale);
+        bench.document(name, value, policies);
+    }
+
+    ConValue report = ConObject();
+    (*report.object)["scale"] = ConValue((int64_t)scale);
+    (*report.object)["repeat"] = ConValue((int64_t)bench.repeat);
+    (*report.object)["results"] = std::move(bench.results);
+    if (out.empty()) {
+        std::cout << report << std::endl;
+        return bench.failed ? 1 : 0;
+    }
+    std::ofstream file(out);
+    file << report << std::endl;
+    if (!file) {
+        std::cerr << "Failed to write " << out << std::endl;
+        return 1;
+    }
+    return bench.failed ? 1 : 0;
+}
@@ -0,0 +1,1176 @@
+/**
+ * CON events
+ * streaming, sax-style access to con and json, nothing is materialized as a tree
+ * readers push events (onStartObject, onKey, onInt, ...) into a handler, and writers are handlers,
+ * so converting or filtering a document is just connecting one to the other:
+ *
+ *     ConEventWriter writer(out);
+ *     conReadJsonEvents(json, writer);
+ *
+ * every handler function returns false to stop reading
+ */
+
+#pragma once
+
+#include "confile.h"
+
+#include <memory>
+#include <string_view>
+
+// all events are optional, handlers don't have to derive from this (the readers are templates),
+// it just makes the writers and the tree builder interchangeable
+struct ConHandler {
+    virtual ~ConHandler() = default;
+
+    virtual bool onNull() { return true; }
+    virtual bool onBool(bool) { return true; }
+    virtual bool onInt(int64_t) { return true; }
+    virtual bool onFloat(double) { return true; }
+    // strings and keys are only valid during the call
+    virtual bool onString(std::string_view) { return true; }
+    // the size of an array or object is its number of elements, or CON_SIZE_UNKNOWN
+    virtual bool onStartArray(uint64_t) { return true; }
+    virtual bool onEndArray() { return true; }
+    virtual bool onStartObject(uint64_t) { return true; }
+    virtual bool onKey(std::string_view) { return true; }
+    virtual bool onEndObject() { return true; }
+};
+
+// reads a json value out of `json` and reports it to `handler`
+// big files can be mapped (see ConViewSource) so they never have to be read into memory
+template<typename Handler>
+bool conReadJsonEvents(std::string_view json, Handler& handler) {
+    ConJsonIndex index;
+    bool indexed = conSimdSupport() != ConSimd::None && index.build(json);
+    ConJsonParser parser(json, indexed ? &index : nullptr);
+    if (!parser.parseEvents(handler)) {
+        ConLog() << "Failed to read json: " << parser.error << " at offset " << parser.offset();
+        return false;
+    }
+    return true;
+}
+
+// reads a con document from a stream and reports it to `handler`, one value at a time
+// zlib data is inflated through a fixed window too, only the other codecs need whole compressed values in memory
+struct ConEventReader {
+    std::istream& stream;
+    ConFormat format;
+    // nesting limit, so hostile input can't overflow the stack
+    size_t maxDepth = 1024;
+
+    ConEventReader(std::istream& stream) : stream(stream) {}
+
+    template<typename Handler>
+    bool read(Handler& handler) {
+        if (!format.read(stream)) {
+            ConLog() << "Invalid header";
+            stream.setstate(std::ios::failbit);
+            return false;
+        }
+        ConReader reader{stream, format};
+        return readValue(reader, handler, 0);
+    }
+
+private:
+    // strings are read into this, only valid during their event
+    std::string scratch;
+
+    template<typename Handler>
+    bool readValue(ConReader& reader, Handler& handler, size_t depth) {
+        std::istream& in = reader.stream;
+        bool compact = format.has(CON_FLAG_COMPACT);
+        uint8_t type;
+        if (!in.read((char*)&type, sizeof(uint8_t))) {
+            return false;
+        }
+        if (type == CON_TAG_REFERENCE && format.has(CON_FLAG_SHARED)) {
+            // the events of the shared subtree, as if it was written here
+            uint64_t index;
+            size_t size;
+            const uint8_t* data = reader.readReference(index, size);
+            if (!data) {
+                return false;
+            }
+            ConMemoryBuffer buffer(data, size);
+            std::istream shared(&buffer);
+            ConReader inner = reader.part(shared);
+            inner.sharedLimit = index;
+            if (!readValue(inner, handler, depth)) {
+                in.setstate(std::ios::failbit);
+                return false;
+            }
+            return true;
+        }
+        if (compact && conTagType(type) != (ConType)type) {
+            if (type >= CON_TAG_SMALL_INTEGER) {
+                return handler.onInt(type & 0x7f);
+            }
+            return handler.onBool(type == CON_TAG_TRUE);
+        }
+        switch ((ConType)type) {
+            case ConType::Null:
+                return handler.onNull();
+            case ConType::Boolean: {
+                bool boolean;
+                in.read((char*)&boolean, sizeof(bool));
+                return in && handler.onBool(boolean);
+            }
+            case ConType::Integer: {
+                int64_t integer;
+                if (compact) {
+                    uint64_t value;
+                    if (!reader.readVarint(value)) {
+                        return false;
+                    }
+                    integer = conUnzigzag(value);
+                } else {
+                    in.read((char*)&integer, sizeof(int64_t));
+                }
+                return in && handler.onInt(integer);
+            }
+            case ConType::Float: {
+                double floating;
+                in.read((char*)&floating, sizeof(double));
+                return in && handler.onFloat(floating);
+            }
+            case ConType::String: {
+                std::vector<uint8_t> decompressed;
+                if (!readBlob(reader, scratch, decompressed)) {
+                    return false;
+                }
+                if (!decompressed.empty()) {
+                    return handler.onString(std::string_view((const char*)decompressed.data(), decompressed.size()));
+                }
+                return handler.onString(scratch);
+            }
+            case ConType::Array:
+            case ConType::Object: {
+                if (depth >= maxDepth) {
+                    ConLog() << "Nested too deeply";
+                    in.setstate(std::ios::failbit);
+                    return false;
+                }
+                uint8_t compressed;
+                if (!in.read((char*)&compressed, sizeof(uint8_t))) {
+                    return false;
+                }
+                bool sized = format.version >= 1;
+                if (compressed == CON_BLOCKED && (ConType)type == ConType::Array && sized) {
+                    return readBlocks(reader, handler, depth);
+                } else if (compressed == CON_COLUMNAR && (ConType)type == ConType::Array && sized) {
+                    return readColumns(reader, handler, depth);
+                } else if (compressed == CON_PACKED && (ConType)type == ConType::Array && sized) {
+                    return readPacked(reader, handler);
+                }
+                if (!compressed) {
+                    if (sized) {
+                        // always fixed width, see CON_FLAG_COMPACT
+                        in.ignore(sizeof(uint64_t));
+                    }
+                    return readContainer(reader, (ConType)type, handler, depth);
+                }
+                uint64_t size;
+                uint64_t rawSize = 0;
+                if (!reader.readSize(size) || (sized && !reader.readSize(rawSize))) {
+                    return false;
+                }
+                if (compressed == (uint8_t)ConCodecId::Zlib) {
+                    // inflated through a fixed window while the events go out
+                    ConInflateBuffer inflater(in, size, format.dictionary.get());
+                    std::istream inflated(&inflater);
+                    ConReader inner = reader.part(inflated);
+                    bool result = readContainer(inner, (ConType)type, handler, depth);
+                    inflater.finish();
+                    if (result && (!inflated || !inflater.good() || !in)) {
+                        in.setstate(std::ios::failbit);
+                        return false;
+                    }
+                    return result;
+                }
+                std::vector<uint8_t> data;
+                if (!conReadBytes(in, data, size)) {
+                    return false;
+                }
+                std::vector<uint8_t> decompressed = conDecompress(compressed, data.data(), size, rawSize, format.dictionary.get());
+                if (decompressed.empty() && rawSize != 0) {
+                    in.setstate(std::ios::failbit);
+                    return false;
+                }
+                data = {};
+                ConMemoryBuffer buffer(decompressed.data(), decompressed.size());
+                std::istream bufferStream(&buffer);
+                ConReader inner = reader.part(bufferStream);
+                return readContainer(inner, (ConType)type, handler, depth);
+            }
+            default:
+                ConLog() << "Invalid type: " << (int)type;
+                in.setstate(std::ios::failbit);
+                return false;
+        }
+    }
+
+    // the payload of an array or object, after its header
+    template<typename Handler>
+    bool readContainer(ConReader& reader, ConType type, Handler& handler, size_t depth) {
+        std::istream& in = reader.stream;
+        uint64_t count;
+        if (!reader.readSize(count)) {
+            return false;
+        }
+        bool object = type == ConType::Object;
+        // the tables are only needed for random access
+        if (object && format.has(CON_FLAG_KEY_INDEX)) {
+            in.ignore(count * 2 * sizeof(uint64_t));
+        } else if (format.has(CON_FLAG_OFFSETS)) {
+            in.ignore(count * sizeof(uint64_t));
+        }
+        if (!(object ? handler.onStartObject(count) : handler.onStartArray(count))) {
+            return false;
+        }
+        for (uint64_t i = 0; i < count; i++) {
+            if (object && !readKey(reader, handler)) {
+                return false;
+            }
+            if (!readValue(reader, handler, depth + 1)) {
+                return false;
+            }
+        }
+        return object ? handler.onEndObject() : handler.onEndArray();
+    }
+
+    // the payload of a blocked array (see CON_BLOCKED), after its codec byte
+    // the blocks follow each other, so they are read in order and only the current one is held in memory
+    template<typename Handler>
+    bool readBlocks(ConReader& reader, Handler& handler, size_t depth) {
+        std::istream& in = reader.stream;
+        uint64_t size;
+        uint64_t count;
+        uint64_t blockCount;
+        // bytes of the array after its byte size
+        size_t header = 0;
+        if (!in.read((char*)&size, sizeof(uint64_t)) || !format.readSize(in, count, &header) || !format.readSize(in, blockCount, &header)) {
+            return false;
+        }
+        header += 2 * blockCount * sizeof(uint64_t);
+        if (blockCount > size / (2 * sizeof(uint64_t)) || header > size) {
+            ConLog() << "Invalid block index";
+            in.setstate(std::ios::failbit);
+            return false;
+        }
+        std::vector<uint8_t> index;
+        if (!conReadBytes(in, index, 2 * blockCount * sizeof(uint64_t)) || !handler.onStartArray(count)) {
+            return false;
+        }
+        auto entry = [&](size_t k, size_t field) {
+            uint64_t value;
+            memcpy(&value, index.data() + (2 * k + field) * sizeof(uint64_t), sizeof(uint64_t));
+            return value;
+        };
+        // the first block may start after the end of the index (see ConStreamWriter), the rest follow each other,
+        // without blocks the unused index takes up the rest of the array
+        uint64_t gap = blockCount ? entry(0, 0) : size - header;
+        if (gap > size - header || (gap && (uint64_t)in.ignore(gap).gcount() != gap)) {
+            in.setstate(std::ios::failbit);
+            return false;
+        }
+        for (uint64_t k = 0; k < blockCount; k++) {
+            uint64_t start = entry(k, 1);
+            uint64_t next = k + 1 < blockCount ? entry(k + 1, 1) : count;
+            uint8_t compressed;
+            uint64_t stored;
+            uint64_t rawSize = 0;
+            if (start > next || !in.read((char*)&compressed, sizeof(uint8_t)) || !reader.readSize(stored)
+                || (compressed && !reader.readSize(rawSize))) {
+                in.setstate(std::ios::failbit);
+                return false;
+            }
+            auto elements = [&](ConReader& inner) {
+                for (uint64_t i = start; i < next; i++) {
+                    if (!readValue(inner, handler, depth + 1)) {
+                        return false;
+                    }
+                }
+                return true;
+            };
+            bool result;
+            if (!compressed) {
+                result = elements(reader);
+            } else if (compressed == (uint8_t)ConCodecId::Zlib) {
+                ConInflateBuffer inflater(in, stored, format.dictionary.get());
+                std::istream inflated(&inflater);
+                ConReader inner = reader.part(inflated);
+                result = elements(inner);
+                inflater.finish();
+                if (result && (!inflated || !inflater.good() || !in)) {
+                    in.setstate(std::ios::failbit);
+                    return false;
+                }
+            } else {
+                std::vector<uint8_t> data;
+                if (!conReadBytes(in, data, stored)) {
+                    return false;
+                }
+                std::vector<uint8_t> decompressed = conDecompress(compressed, data.data(), stored, rawSize, format.dictionary.get());
+                if (decompressed.empty() && rawSize != 0) {
+                    in.setstate(std::ios::failbit);
+                    return false;
+                }
+                ConMemoryBuffer buffer(decompressed.data(), decompressed.size());
+                std::istream bufferStream(&buffer);
+                ConReader inner = reader.part(bufferStream);
+                result = elements(inner);
+            }
+            if (!result) {
+                return false;
+            }
+        }
+        return handler.onEndArray();
+    }
+
+    // the payload of a columnar array (see CON_COLUMNAR), after its codec byte
+    // the rows are put back together, so the events are the same as for an array of objects
+    template<typename Handler>
+    bool readColumns(ConReader& reader, Handler& handler, size_t depth) {
+        std::istream& in = reader.stream;
+        uint64_t size;
+        if (!in.read((char*)&size, sizeof(uint64_t))) {
+            return false;
+        }
+        std::vector<uint8_t> data;
+        ConColumnLayout layout;
+        if (!conReadBytes(in, data, size)) {
+            return false;
+        } else if (!layout.read(format, data.data(), data.data() + size)) {
+            ConLog() << "Invalid columns";
+            in.setstate(std::ios::failbit);
+            return false;
+        }
+        size_t fields = layout.columns.size();
+        std::vector<std::vector<uint8_t>> storage(fields);
+        std::vector<ConColumn> columns(fields);
+        // columns of encoded values are read one value per row
+        std::vector<std::unique_ptr<ConMemoryBuffer>> buffers(fields);
+        std::vector<std::unique_ptr<std::istream>> streams(fields);
+        for (size_t field = 0; field < fields; field++) {
+            ConColumn& column = columns[field];
+            if (!layout.columns[field].load(layout.rows, storage[field], column)) {
+                ConLog() << "Invalid column";
+                in.setstate(std::ios::failbit);
+                return false;
+            }
+            if (column.kind == CON_COLUMN_VALUES) {
+                buffers[field] = std::make_unique<ConMemoryBuffer>(column.data, column.end - column.data);
+                streams[field] = std::make_unique<std::istream>(buffers[field].get());
+            }
+        }
+        if (!handler.onStartArray(layout.rows)) {
+            return false;
+        }
+        for (uint64_t row = 0; row < layout.rows; row++) {
+            if (!handler.onStartObject(fields)) {
+                return false;
+            }
+            for (size_t field = 0; field < fields; field++) {
+                const ConColumn& column = columns[field];
+                if (!handler.onKey(layout.keys[field])) {
+                    return false;
+                }
+                bool result;
+                if (column.kind == CON_COLUMN_VALUES) {
+                    ConReader inner = reader.part(*streams[field]);
+                    result = readValue(inner, handler, depth + 2);
+                } else {
+                    result = readCell(column, row, handler);
+                }
+                if (!result) {
+                    return false;
+                }
+            }
+            if (!handler.onEndObject()) {
+                return false;
+            }
+        }
+        return handler.onEndArray();
+    }
+
+    // the payload of a packed array (see CON_PACKED), after its codec byte
+    template<typename Handler>
+    bool readPacked(ConReader& reader, Handler& handler) {
+        std::istream& in = reader.stream;
+        uint64_t size;
+        if (!in.read((char*)&size, sizeof(uint64_t))) {
+            return false;
+        }
+        std::vector<uint8_t> data;
+        if (!conReadBytes(in, data, size)) {
+            return false;
+        }
+        const uint8_t* p = data.data();
+        const uint8_t* end = p + size;
+        uint64_t count;
+        ConColumnLayout::Column stored;
+        std::vector<uint8_t> storage;
+        ConColumn column;
+        if (!format.readSize(p, end, count) || !ConColumnLayout::readColumn(format, p, end, stored) || !stored.load(count, storage, column) || column.kind == (uint8_t)ConType::Null || column.kind == (uint8_t)ConType::String || column.kind == CON_COLUMN_VALUES) {
+            ConLog() << "Invalid packed array";
+            in.setstate(std::ios::failbit);
+            return false;
+        }
+        if (!handler.onStartArray(count)) {
+            return false;
+        }
+        for (uint64_t i = 0; i < count; i++) {
+            if (!readCell(column, i, handler)) {
+                return false;
+            }
+        }
+        return handler.onEndArray();
+    }
+
+    // a value of a typed column
+    template<typename Handler>
+    bool readCell(const ConColumn& column, size_t row, Handler& handler) {
+        if (column.isNull(row)) {
+            return handler.onNull();
+        } else if (column.kind == (uint8_t)ConType::Integer) {
+            return handler.onInt(column.integer(row));
+        } else if (column.kind == (uint8_t)ConType::Float) {
+            return handler.onFloat(column.floating(row));
+        } else if (column.kind == (uint8_t)ConType::Boolean) {
+            return handler.onBool(column.boolean(row));
+        }
+        return handler.onString(column.string(row));
+    }
+
+    template<typename Handler>
+    bool readKey(ConReader& reader, Handler& handler) {
+        uint64_t keySize;
+        if (!reader.readSize(keySize)) {
+            return false;
+        }
+        if (format.has(CON_FLAG_KEY_DICTIONARY)) {
+            // keySize is the index of the key
+            if (keySize >= format.keys.size()) {
+                ConLog() << "Invalid key index: " << keySize;
+                reader.stream.setstate(std::ios::failbit);
+                return false;
+            }
+            return handler.onKey(format.keys[keySize]);
+        }
+        scratch.clear();
+        if (!conReadBytes(reader.stream, scratch, keySize)) {
+            return false;
+        }
+        return handler.onKey(scratch);
+    }
+
+    // a string, either read into `raw` or inflated into `decompressed`
+    bool readBlob(ConReader& reader, std::string& raw, std::vector<uint8_t>& decompressed) {
+        std::istream& in = reader.stream;
+        uint8_t compressed;
+        uint64_t size;
+        if (!in.read((char*)&compressed, sizeof(uint8_t)) || !reader.readSize(size)) {
+            return false;
+        }
+        if (!compressed) {
+            raw.clear();
+            return conReadBytes(in, raw, size);
+        }
+        uint64_t rawSize = 0;
+        if (format.version >= 1 && !reader.readSize(rawSize)) {
+            return false;
+        }
+        if (compressed == (uint8_t)ConCodecId::Zlib) {
+            ConInflateBuffer inflater(in, size, format.dictionary.get());
+            if (!conInflateString(inflater, rawSize, raw)) {
+                in.setstate(std::ios::failbit);
+                return false;
+            }
+            return true;
+        }
+        std::vector<uint8_t> data;
+        if (!conReadBytes(in, data, size)) {
+            return false;
+        }
+        decompressed = conDecompress(compressed, data.data(), size, rawSize, format.dictionary.get());
+        if (decompressed.empty() && rawSize != 0) {
+            in.setstate(std::ios::failbit);
+            return false;
+        }
+        if (decompressed.empty()) {
+            raw.clear();
+        }
+        return true;
+    }
+};
+
+// reports a tree to `handler`, the same events a reader would produce
+template<typename Handler>
+bool conEmitEvents(const ConValue& value, Handler& handler) {
+    switch (value.type) {
+        case ConType::Null:
+            return handler.onNull();
+        case ConType::Boolean:
+            return handler.onBool(value.boolean);
+        case ConType::Integer:
+            return handler.onInt(value.integer);
+        case ConType::Float:
+            return handler.onFloat(value.floating);
+        case ConType::String:
+            return handler.onString(value.string);
+        case ConType::Array:
+            if (!handler.onStartArray(value.array->values.size())) {
+                return false;
+            }
+            for (const ConValue& element : value.array->values) {
+                if (!conEmitEvents(element, handler)) {
+                    return false;
+                }
+            }
+            return handler.onEndArray();
+        case ConType::Object:
+            if (!handler.onStartObject(value.object->values.size())) {
+                return false;
+            }
+            for (auto& [key, element] : value.object->values) {
+                if (!handler.onKey(key) || !conEmitEvents(element, handler)) {
+                    return false;
+                }
+            }
+            return handler.onEndObject();
+        default:
+            return false;
+    }
+}
+
+// builds a tree out of events, for the parts of a stream that should be materialized after all
+struct ConTreeBuilder : ConHandler {
+    ConValue& root;
+    std::pmr::memory_resource* resource;
+
+    ConTreeBuilder(ConValue& root, std::pmr::memory_resource* resource=std::pmr::get_default_resource()) : root(root), resource(resource) {}
+
+    // whether a whole value has been built
+    bool done() const {
+        return started && stack.empty();
+    }
+
+    bool onNull() override { return place(ConValue()); }
+    bool onBool(bool value) override { return place(ConValue(value)); }
+    bool onInt(int64_t value) override { return place(ConValue(value)); }
+    bool onFloat(double value) override { return place(ConValue(value)); }
+    bool onString(std::string_view value) override { return place(ConValue(std::pmr::string(value, resource))); }
+
+    // sizes come straight from the document, see CON_RESERVE_LIMIT
+    bool onStartArray(uint64_t size) override {
+        ConValue* value = place(ConValue(ConArray(resource)));
+        if (value && size != CON_SIZE_UNKNOWN) {
+            value->array->values.reserve(std::min(size, CON_RESERVE_LIMIT));
+        }
+        return open(value);
+    }
+
+    bool onStartObject(uint64_t size) override {
+        ConValue* value = place(ConValue(ConObject(resource)));
+        if (value && size != CON_SIZE_UNKNOWN) {
+            value->object->values.reserve(std::min(size, CON_RESERVE_LIMIT));
+        }
+        return open(value);
+    }
+
+    bool onKey(std::string_view key) override {
+        if (stack.empty() || stack.back()->type != ConType::Object) {
+            ConLog() << "Key outside of an object";
+            return false;
+        }
+        // the object owns the key right away, and the slot is filled by the next value
+        // entries are sorted once the object is closed
+        slot = &stack.back()->object->values.append(key);
+        return true;
+    }
+
+    bool onEndArray() override { return close(ConType::Array); }
+    bool onEndObject() override { return close(ConType::Object); }
+
+private:
+    // the containers that are still open, the values don't move until they're closed
+    std::vector<ConValue*> stack;
+    // where the next value in an object goes
+    ConValue* slot = nullptr;
+    bool started = false;
+
+    ConValue* place(ConValue value) {
+        ConValue* target;
+        if (stack.empty()) {
+            if (started) {
+                ConLog() << "More than one top-level value";
+                return nullptr;
+            }
+            target = &root;
+        } else if (stack.back()->type == ConType::Array) {
+            stack.back()->array->values.emplace_back();
+            target = &stack.back()->array->values.back();
+        } else if (slot) {
+            target = slot;
+            slot = nullptr;
+        } else {
+            ConLog() << "Value without a key";
+            return nullptr;
+        }
+        started = true;
+        *target = std::move(value);
+        return target;
+    }
+
+    bool open(ConValue* value) {
+        if (!value) {
+            return false;
+        }
+        stack.push_back(value);
+        return true;
+    }
+
+    bool close(ConType type) {
+        if (stack.empty() || stack.back()->type != type || slot) {
+            ConLog() << "Unbalanced " << (type == ConType::Array ? "array" : "object");
+            return false;
+        }
+        if (type == ConType::Object) {
+            stack.back()->object->values.sort();
+        }
+        stack.pop_back();
+        return true;
+    }
+};
+
+// writes events as a con document to a stream, without ever holding more than a small buffer
+// counts that aren't known up front (json) and the byte sizes of version 1 are patched afterwards,
+// in the buffer if they're still in it, otherwise by seeking back, so those need a seekable stream
+// only version and codec matter in the options: nothing is compressed, and the tables, compact encoding
+// and key dictionary need the whole container before it is written so they aren't supported here
+struct ConEventWriter : ConHandler {
+    std::ostream& stream;
+
+    const static size_t FLUSH_SIZE = 64 * 1024;
+
+    ConEventWriter(std::ostream& stream, const ConWriteOptions& options={}) : stream(stream), writer(streamOptions(options)) {
+        start = stream.tellp();
+        writer.writeHeader();
+    }
+
+    ~ConEventWriter() {
+        flush();
+    }
+
+    // whether a whole value has been written
+    bool done() const {
+        return started && stack.empty();
+    }
+
+    void flush() {
+        written += writer.size();
+        writer.flush(stream);
+    }
+
+    bool onNull() override {
+        return value(ConType::Null);
+    }
+
+    bool onBool(bool boolean) override {
+        if (!value(ConType::Boolean)) {
+            return false;
+        }
+        writer.write(boolean);
+        return true;
+    }
+
+    bool onInt(int64_t integer) override {
+        if (!value(ConType::Integer)) {
+            return false;
+        }
+        writer.write(integer);
+        return true;
+    }
+
+    bool onFloat(double floating) override {
+        if (!value(ConType::Float)) {
+            return false;
+        }
+        writer.write(floating);
+        return true;
+    }
+
+    bool onString(std::string_view str) override {
+        if (!value(ConType::String)) {
+            return false;
+        }
+        writer.put(0);
+        writer.writeSize(str.size());
+        writer.write(str.data(), str.size());
+        return true;
+    }
+
+    bool onStartArray(uint64_t size) override {
+        return open(ConType::Array, size);
+    }
+
+    bool onStartObject(uint64_t size) override {
+        return open(ConType::Object, size);
+    }
+
+    bool onKey(std::string_view key) override {
+        if (!available()) {
+            return false;
+        } else if (stack.empty() || !stack.back().object || stack.back().keyed) {
+            ConLog() << "Key outside of an object";
+            return false;
+        }
+        stack.back().keyed = true;
+        writer.writeSize(key.size());
+        writer.write(key.data(), key.size());
+        return true;
+    }
+
+    bool onEndArray() override {
+        return close(false);
+    }
+
+    bool onEndObject() override {
+        return close(true);
+    }
+
+protected:
+    struct Container {
+        bool object;
+        // whether the key of the next value has been written
+        bool keyed;
+        uint64_t count;
+        // CON_SIZE_UNKNOWN if it has to be patched
+        uint64_t expected;
+        // positions in the output, relative to where it started
+        uint64_t sizeAt;
+        uint64_t countAt;
+        uint64_t payloadAt;
+    };
+
+    ConWriter writer;
+    std::vector<Container> stack;
+    std::streampos start;
+    // bytes already passed on to the stream
+    uint64_t written = 0;
+    bool started = false;
+    // an array of a ConStreamWriter is open, only its elements can be written until it is closed
+    bool streaming = false;
+
+    static ConWriteOptions streamOptions(ConWriteOptions options) {
+        if (options.offsetTable || options.keyIndex || options.compact || options.keyDictionary || options.blockElements || options.blockBytes || options.columnar || options.packed || options.delta || options.shared) {
+            ConLog(ConLogLevel::Warning) << "Streaming writes don't support tables, compact encoding, key dictionaries, blocks, columns, packed arrays or shared subtrees, ignoring them";
+        }
+        options.shared = false;
+        options.blockElements = 0;
+        options.blockBytes = 0;
+        options.columnar = false;
+        options.packed = false;
+        options.delta = false;
+        options.offsetTable = false;
+        options.keyIndex = false;
+        options.compact = false;
+        options.keyDictionary = false;
+        options.codec = ConCodecId::None;
+        return options;
+    }
+
+    uint64_t position() const {
+        return written + writer.size();
+    }
+
+    bool available() const {
+        if (streaming) {
+            ConLog() << "Only append() can be used inside of a streamed array";
+            return false;
+        }
+        return true;
+    }
+
+    // writes the type of the next value, after checking it can go here
+    bool value(ConType type) {
+        if (!available()) {
+            return false;
+        } else if (stack.empty()) {
+            if (started) {
+                ConLog() << "More than one top-level value";
+                return false;
+            }
+            started = true;
+        } else {
+            Container& parent = stack.back();
+            if (parent.object && !parent.keyed) {
+                ConLog() << "Value without a key";
+                return false;
+            }
+            parent.keyed = false;
+            parent.count++;
+            if (writer.size() >= FLUSH_SIZE) {
+                flush();
+            }
+        }
+        writer.put((uint8_t)type);
+        return true;
+    }
+
+    bool open(ConType type, uint64_t size) {
+        if (!value(type)) {
+            return false;
+        }
+        Container container = {type == ConType::Object, false, 0, size, 0, 0, 0};
+        writer.put(0);
+        if (writer.format.version >= 1) {
+            container.sizeAt = position();
+            writer.write((uint64_t)0);
+        }
+        container.countAt = position();
+        writer.write(size == CON_SIZE_UNKNOWN ? (uint64_t)0 : size);
+        container.payloadAt = position();
+        stack.push_back(container);
+        return true;
+    }
+
+    bool close(bool object) {
+        if (!available()) {
+            return false;
+        } else if (stack.empty() || stack.back().object != object || stack.back().keyed) {
+            ConLog() << "Unbalanced " << (object ? "object" : "array");
+            return false;
+        }
+        Container container = stack.back();
+        stack.pop_back();
+        if (container.expected == CON_SIZE_UNKNOWN) {
+            if (!patch(container.countAt, container.count)) {
+                return false;
+            }
+        } else if (container.expected != container.count) {
+            ConLog() << "Expected " << container.expected << " elements, got " << container.count;
+            return false;
+        }
+        if (writer.format.version >= 1) {
+            // the byte size covers the count and the payload
+            return patch(container.sizeAt, position() - container.countAt);
+        }
+        return true;
+    }
+
+    bool patch(uint64_t at, uint64_t value) {
+        return patch(at, &value, sizeof(value));
+    }
+
+    // overwrites `size` bytes at `at`, in the buffer as far as they're still in it, the rest by seeking back
+    bool patch(uint64_t at, const void* data, size_t size) {
+        const uint8_t* bytes = (const uint8_t*)data;
+        if (size > 0 && at + size > written) {
+            size_t flushed = at < written ? written - at : 0;
+            memcpy(writer.data(at + flushed - written), bytes + flushed, size - flushed);
+            size = flushed;
+        }
+        if (size == 0) {
+            return true;
+        }
+        if (start == std::streampos(-1)) {
+            ConLog() << "Can't patch a size that was already written to an unseekable stream";
+            stream.setstate(std::ios::failbit);
+            return false;
+        }
+        std::streampos end = start + (std::streamoff)written;
+        stream.seekp(start + (std::streamoff)at);
+        stream.write((const char*)bytes, size);
+        stream.seekp(end);
+        return (bool)stream;
+    }
+};
+
+// writes a document like ConEventWriter, but arrays opened with beginArray() take whole values through append()
+// and are split into blocks (see CON_BLOCKED) that are compressed and passed on to the stream as soon as they're full,
+// so a huge array can be produced element by element while only about one block of it is held in memory
+// blocks end at the block limits of the options (BLOCK_BYTES if they don't set any), and are compressed
+// with the codec and policy of the options at the depth of the array (shouldCompress is called with a null value)
+// room for the block index is reserved when the array is opened and filled in when it is closed, so an array holds
+// at most as many blocks as were reserved (see beginArray), and like the sizes of ConEventWriter the index is patched
+// by seeking back if it was passed on already, the unused part of it is dropped if the array is still in the buffer
+// and otherwise stays in front of the blocks, once an array has too many blocks the writer fails
+// version 0 has no blocks, its arrays are written element by element without compression
+struct ConStreamWriter : ConEventWriter {
+    const static uint64_t BLOCK_BYTES = 1024 * 1024;
+
+    // `maxBlocks` is the room reserved for the block index of arrays that don't say how many blocks they'll need
+    ConStreamWriter(std::ostream& stream, const ConWriteOptions& options={}, uint64_t maxBlocks=256)
+        : ConEventWriter(stream, eventOptions(options)), maxBlocks(maxBlocks) {
+        // elements are encoded like the rest of the document, only the blocks get the codec
+        ConWriteOptions blockOptions = writer.options;
+        blockOptions.codec = options.codec;
+        blockOptions.blockElements = options.blockElements;
+        blockOptions.blockBytes = options.blockElements || options.blockBytes ? options.blockBytes : BLOCK_BYTES;
+        block.emplace(blockOptions);
+        block->format = writer.format;
+    }
+
+    // opens an array at the next position (like onStartArray), its elements are added with append()
+    // `blocks` is the most blocks it can be split into (16 bytes each are reserved), 0 for the maxBlocks of the writer
+    bool beginArray(uint64_t blocks=0) {
+        if (failed) {
+            return false;
+        } else if (writer.format.version == 0) {
+            streaming = onStartArray(CON_SIZE_UNKNOWN);
+            return streaming;
+        } else if (!value(ConType::Array)) {
+            return false;
+        }
+        streaming = true;
+        level = stack.size();
+        count = 0;
+        reserved = blocks ? blocks : maxBlocks;
+        starts.clear();
+        writer.put(CON_BLOCKED);
+        sizeAt = position();
+        writer.write((uint64_t)0);
+        // always fixed width, the document isn't compact
+        writer.write((uint64_t)0);
+        writer.write((uint64_t)0);
+        indexAt = position();
+        writer.buffer.resize(writer.size() + reserved * 2 * sizeof(uint64_t));
+        return true;
+    }
+
+    // false once the array has more blocks than were reserved, endArray() reports it
+    bool append(ConValue& value) {
+        if (!streaming) {
+            ConLog() << "append() outside of a streamed array, see beginArray()";
+            return false;
+        } else if (failed) {
+            return false;
+        }
+        if (writer.format.version == 0) {
+            stack.back().count++;
+            value.write(writer, stack.size());
+            if (writer.size() >= FLUSH_SIZE) {
+                flush();
+            }
+            return true;
+        }
+        if (pending == 0) {
+            blockFirst = count;
+        }
+        value.write(*block, level + 1);
+        count++;
+        pending++;
+        const ConWriteOptions& options = block->options;
+        if ((options.blockElements && pending >= options.blockElements) || (options.blockBytes && block->size() >= options.blockBytes)) {
+            return writeBlock();
+        }
+        return true;
+    }
+
+    bool append(ConValue&& value) {
+        return append(value);
+    }
+
+    // closes the array opened by beginArray(), after filling in its sizes and block index
+    bool endArray() {
+        if (!streaming) {
+            ConLog() << "endArray() without beginArray()";
+            return false;
+        }
+        streaming = false;
+        if (writer.format.version == 0) {
+            return onEndArray();
+        }
+        if (failed || !writeBlock()) {
+            ConLog() << "More than " << reserved << " blocks in a streamed array, reserve more or raise the block limits";
+            return false;
+        }
+        uint64_t blockCount = starts.size();
+        // the unused part of the index is dropped if it is still in the buffer
+        uint64_t unused = (reserved - blockCount) * 2 * sizeof(uint64_t);
+        if (indexAt >= written && unused > 0) {
+            auto from = writer.buffer.begin() + (indexAt - written) + blockCount * 2 * sizeof(uint64_t);
+            writer.buffer.erase(from, from + unused);
+            for (auto& [at, first] : starts) {
+                at -= unused;
+            }
+        }
+        // block offsets are relative to the end of the index, the unused part of it included
+        std::vector<uint64_t> index;
+        for (auto [at, first] : starts) {
+            index.push_back(at - indexAt - blockCount * 2 * sizeof(uint64_t));
+            index.push_back(first);
+        }
+        return patch(indexAt, index.data(), index.size() * sizeof(uint64_t)) && patch(sizeAt + sizeof(uint64_t), count)
+            && patch(sizeAt + 2 * sizeof(uint64_t), blockCount) && patch(sizeAt, position() - sizeAt - sizeof(uint64_t));
+    }
+
+private:
+    uint64_t maxBlocks;
+    // blocks the open array has room for
+    uint64_t reserved = 0;
+    // an array had more blocks than that, nothing more can be written
+    bool failed = false;
+    // the elements of the block that is being filled
+    std::optional<ConWriter> block;
+    // depth of the open array
+    uint64_t level = 0;
+    // elements of the array so far, and of the block that is being filled
+    uint64_t count = 0;
+    uint64_t pending = 0;
+    // index of the first element of that block
+    uint64_t blockFirst = 0;
+    // positions of the byte size of the array and its block index
+    uint64_t sizeAt = 0;
+    uint64_t indexAt = 0;
+    // position and first element of every block
+    std::vector<std::pair<uint64_t, uint64_t>> starts;
+
+    // the block limits are only for the streamed arrays, ConEventWriter would warn about them
+    static ConWriteOptions eventOptions(ConWriteOptions options) {
+        options.blockElements = 0;
+        options.blockBytes = 0;
+        return options;
+    }
+
+    bool writeBlock() {
+        if (pending == 0) {
+            return true;
+        } else if (starts.size() == reserved) {
+            failed = true;
+            stream.setstate(std::ios::failbit);
+            return false;
+        }
+        starts.emplace_back(position(), blockFirst);
+        const uint8_t* data = block->data();
+        size_t size = block->size();
+        std::vector<uint8_t> compressed;
+        if (block->shouldCompress(conNull(), level, data, size)) {
+            compressed = block->compress(data, size);
+        }
+        if (!compressed.empty()) {
+            writer.put((uint8_t)block->codec->id);
+            writer.writeSize(compressed.size());
+            writer.writeSize(size);
+            writer.write(compressed.data(), compressed.size());
+        } else {
+            writer.put(0);
+            writer.writeSize(size);
+            writer.write(data, size);
+        }
+        block->buffer.clear();
+        pending = 0;
+        if (writer.size() >= FLUSH_SIZE) {
+            flush();
+        }
+        return true;
+    }
+};
+
+// writes events as json, see ConJsonWriter
+struct ConJsonEventWriter : ConHandler {
+    ConJsonWriter json;
+
+    ConJsonEventWriter(ConJsonStyle style=ConJsonStyle::Compact, std::ostream* stream=nullptr) : json(style, stream) {}
+
+    bool onNull() override {
+        next();
+        json.buffer += "null";
+        return done();
+    }
+
+    bool onBool(bool value) override {
+        next();
+        json.buffer += value ? "true" : "false";
+        return done();
+    }
+
+    bool onInt(int64_t value) override {
+        return number(ConValue(value));
+    }
+
+    bool onFloat(double value) override {
+        return number(ConValue(value));
+    }
+
+    bool onString(std::string_view value) override {
+        next();
+        json.writeString(value);
+        return done();
+    }
+
+    bool onStartArray(uint64_t) override {
+        next();
+        json.buffer += '[';
+        first.push_back(true);
+        return true;
+    }
+
+    bool onStartObject(uint64_t) override {
+        next();
+        json.buffer += '{';
+        first.push_back(true);
+        return true;
+    }
+
+    bool onKey(std::string_view key) override {
+        bool empty = first.back();
+        json.separate(empty, first.size());
+        first.back() = empty;
+        json.key(key);
+        keyed = true;
+        return true;
+    }
+
+    bool onEndArray() override {
+        return end(']');
+    }
+
+    bool onEndObject() override {
+        return end('}');
+    }
+
+private:
+    // whether nothing has been written in each open container yet
+    std::vector<bool> first;
+    // whether a key was just written, so the value needs no separator
+    bool keyed = false;
+
+    // the separator before an array element
+    void next() {
+        if (keyed) {
+            keyed = false;
+        } else if (!first.empty()) {
+            bool empty = first.back();
+            json.separate(empty, first.size());
+            first.back() = empty;
+        }
+    }
+
+    bool number(const ConValue& value) {
+        next();
+        char buffer[CON_NUMBER_SIZE];
+        json.buffer.append(buffer, conFormatNumber(buffer, value));
+        return done();
+    }
+
+    bool end(char bracket) {
+        if (first.empty()) {
+            ConLog() << "Unbalanced " << (bracket == ']' ? "array" : "object");
+            return false;
+        }
+        json.close(first.back(), first.size() - 1);
+        json.buffer += bracket;
+        first.pop_back();
+        return done();
+    }
+
+    // the top-level value is flushed right away
+    bool done() {
+        if (first.empty()) {
+            json.flush();
+        }
+        return true;
+    }
+};
@@ -9,16 +9,298 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
+#include <cstdlib>
 #include <string>
 #include <vector>
 #include <map>
+#include <memory_resource>
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <unordered_map>
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <functional>
+#include <optional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <atomic>
+#include <deque>
+#include <array>
+#include <bit>
+#include <chrono>
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#endif
 
 #include <zlib.h>
+#ifdef CONFILE_WITH_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+#ifdef CONFILE_WITH_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
 
-std::vector<uint8_t> zcompress(std::vector<uint8_t> input) {
+enum class ConLogLevel {
+    // something was ignored or replaced, e.g. an unsupported option
+    Warning,
+    // reading or writing failed, the stream/return value says so too
+    Error,
+};
+
+using ConLogger = std::function<void(ConLogLevel level, std::string_view message)>;
+
+// where the messages of the library go, std::cerr unless it is replaced (nullptr drops them),
+// warnings are prefixed with "warning: " there, errors are printed as they are
+// it is called from worker threads too, so set it before reading or writing and keep it thread-safe
+ConLogger& conLogger() {
+    static ConLogger logger = [](ConLogLevel level, std::string_view message) {
+        std::cerr << (level == ConLogLevel::Warning ? "warning: " : "") << message << std::endl;
+    };
+    return logger;
+}
+
+// one message, put together with << and passed to conLogger() at the end of the statement
+struct ConLog {
+    ConLogLevel level;
+    std::ostringstream message;
+
+    ConLog(ConLogLevel level=ConLogLevel::Error) : level(level) {}
+
+    ~ConLog() {
+        if (const ConLogger& logger = conLogger()) {
+            logger(level, message.view());
+        }
+    }
+
+    template<typename T>
+    ConLog& operator<<(const T& value) {
+        message << value;
+        return *this;
+    }
+};
+
+struct ConValue;
+enum class ConType : uint8_t;
+
+// numbers about reading or writing a document, to find out where the bytes and the time go
+// (see ConWriteOptions::stats and ConValue::read), one collector can be passed to several reads/writes and adds them up
+// worker threads record into it too, so it is locked while recording, read it once the read/write is done
+struct ConStats {
+    // how many subtrees `largest` holds
+    const static size_t LARGEST = 16;
+
+    // the strings, arrays and objects at one depth (0 is the top-level value)
+    struct Level {
+        uint64_t values = 0;
+        // encoded bytes, including type bytes and headers, subtrees count at every depth they are below (writes only)
+        uint64_t bytes = 0;
+        // how many of them are stored compressed (as a whole, compressed blocks and columns of arrays are only in the totals)
+        uint64_t compressed = 0;
+        // the size of their payloads before and after compression
+        // (version 0 documents don't store it for arrays and objects, reads leave those out)
+        uint64_t rawBytes = 0;
+        uint64_t compressedBytes = 0;
+    };
+
+    // one of the largest subtrees of a write
+    struct Subtree {
+        // to the subtree from the top-level value, in ConSelection syntax (e.g. "users[3].name"), empty for the top-level value
+        std::string path;
+        // the subtree itself, only valid while the written value is
+        const ConValue* value;
+        ConType type;
+        uint64_t depth;
+        // encoded size
+        uint64_t bytes;
+        bool compressed;
+    };
+
+    std::vector<Level> levels;
+    // largest first
+    std::vector<Subtree> largest;
+
+    // size of the documents read or written (reads from streams that can't tell their position don't add to it)
+    uint64_t bytes = 0;
+    // time spent reading/writing, and the part of it spent inside of the codec (from every thread)
+    double seconds = 0.0;
+    double codecSeconds = 0.0;
+    // codec calls and the bytes that went in and came out of them, the ones that weren't stored
+    // (see ConWriteOptions::minSavings) included, zlib values that are inflated while parsing count every window
+    uint64_t codecCalls = 0;
+    uint64_t codecInput = 0;
+    uint64_t codecOutput = 0;
+    // allocations of decoded trees: nodes, element buffers and strings/keys too long to be stored inline (reads only)
+    uint64_t allocations = 0;
+
+    ConStats() = default;
+    ConStats(const ConStats& other) {
+        *this = other;
+    }
+    ConStats& operator=(const ConStats& other) {
+        levels = other.levels;
+        largest = other.largest;
+        bytes = other.bytes;
+        seconds = other.seconds;
+        codecSeconds = other.codecSeconds;
+        codecCalls = other.codecCalls;
+        codecInput = other.codecInput;
+        codecOutput = other.codecOutput;
+        allocations = other.allocations;
+        return *this;
+    }
+
+    // a string, array or object was read or written, `size` is its encoded size (0 if it isn't known)
+    // `value` is only given by writes, it may end up in `largest`
+    void record(uint64_t depth, ConType type, uint64_t size, bool compressed, uint64_t rawBytes, uint64_t compressedBytes, const ConValue* value=nullptr) {
+        std::lock_guard lock(mutex);
+        if (levels.size() <= depth) {
+            levels.resize(depth + 1);
+        }
+        Level& level = levels[depth];
+        level.values++;
+        level.bytes += size;
+        if (compressed) {
+            level.compressed++;
+            level.rawBytes += rawBytes;
+            level.compressedBytes += compressedBytes;
+        }
+        if (value && (largest.size() < LARGEST || size > largest.back().bytes)) {
+            if (largest.size() == LARGEST) {
+                largest.pop_back();
+            }
+            auto it = std::upper_bound(largest.begin(), largest.end(), size, [](uint64_t size, const Subtree& subtree) {
+                return size > subtree.bytes;
+            });
+            largest.insert(it, Subtree{{}, value, type, depth, size, compressed});
+        }
+    }
+
+    // a codec compressed or decompressed `input` bytes into `output` bytes
+    void codec(std::chrono::steady_clock::time_point start, uint64_t input, uint64_t output) {
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::lock_guard lock(mutex);
+        codecSeconds += elapsed;
+        codecCalls++;
+        codecInput += input;
+        codecOutput += output;
+    }
+
+    void allocated(uint64_t count) {
+        std::lock_guard lock(mutex);
+        allocations += count;
+    }
+
+    // a whole document of `size` bytes was read or written, starting at `start`
+    void document(std::chrono::steady_clock::time_point start, uint64_t size) {
+        std::lock_guard lock(mutex);
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        bytes += size;
+    }
+
+    // fills in the paths of the subtrees in `largest` that are inside of `root`
+    void resolve(const ConValue& root);
+
+private:
+    std::mutex mutex;
+};
+
+// shared context for compressing many small documents of the same shape: every compressed value of a document
+// written with it (see ConWriteOptions::dictionary) starts out as if it came right after the dictionary,
+// so the first occurrence of keys and common strings in a value is already cheap (see CON_FLAG_DICTIONARY)
+// documents refer to it by id, readers find it among the registered ones (see conRegisterDictionary)
+struct ConDictionary {
+    uint32_t id;
+    // raw content for zlib and lz4, a trained (or raw) zstd dictionary for zstd (see conTrainDictionary)
+    std::vector<uint8_t> data;
+
+    // an id of 0 is derived from the content
+    ConDictionary(std::vector<uint8_t> data, uint32_t id=0) : id(id), data(std::move(data)) {
+        if (this->id == 0) {
+            // fnv-1a, never 0 so it can't be confused with "no id"
+            uint32_t hash = 2166136261u;
+            for (uint8_t byte : this->data) {
+                hash = (hash ^ byte) * 16777619u;
+            }
+            this->id = hash ? hash : 1;
+        }
+    }
+    ConDictionary(const ConDictionary&) = delete;
+    ConDictionary& operator=(const ConDictionary&) = delete;
+
+#ifdef CONFILE_WITH_ZSTD
+    ~ConDictionary() {
+        for (auto& [level, dictionary] : compression) {
+            ZSTD_freeCDict(dictionary);
+        }
+        ZSTD_freeDDict(decompression);
+    }
+
+    // the dictionary digested for zstd, once per compression level
+    const ZSTD_CDict* zstdCompression(int level) const {
+        std::lock_guard lock(mutex);
+        ZSTD_CDict*& dictionary = compression[level];
+        if (!dictionary) {
+            dictionary = ZSTD_createCDict(data.data(), data.size(), level);
+        }
+        return dictionary;
+    }
+
+    const ZSTD_DDict* zstdDecompression() const {
+        std::lock_guard lock(mutex);
+        if (!decompression) {
+            decompression = ZSTD_createDDict(data.data(), data.size());
+        }
+        return decompression;
+    }
+
+private:
+    mutable std::mutex mutex;
+    mutable std::map<int, ZSTD_CDict*> compression;
+    mutable ZSTD_DDict* decompression = nullptr;
+#endif
+};
+
+// the dictionaries that documents can refer to, set up once per process
+struct ConDictionaries {
+    std::mutex mutex;
+    std::unordered_map<uint32_t, std::shared_ptr<const ConDictionary>> dictionaries;
+};
+
+ConDictionaries& conDictionaries() {
+    static ConDictionaries registry;
+    return registry;
+}
+
+// makes documents that refer to the dictionary readable, replaces a dictionary with the same id
+std::shared_ptr<const ConDictionary> conRegisterDictionary(std::shared_ptr<const ConDictionary> dictionary) {
+    ConDictionaries& registry = conDictionaries();
+    std::lock_guard lock(registry.mutex);
+    registry.dictionaries[dictionary->id] = dictionary;
+    return dictionary;
+}
+
+std::shared_ptr<const ConDictionary> conRegisterDictionary(std::vector<uint8_t> data, uint32_t id=0) {
+    return conRegisterDictionary(std::make_shared<const ConDictionary>(std::move(data), id));
+}
+
+// nullptr if no dictionary with the id was registered
+std::shared_ptr<const ConDictionary> conFindDictionary(uint32_t id) {
+    ConDictionaries& registry = conDictionaries();
+    std::lock_guard lock(registry.mutex);
+    auto it = registry.dictionaries.find(id);
+    return it != registry.dictionaries.end() ? it->second : nullptr;
+}
+
+std::vector<uint8_t> zcompress(const uint8_t* input, size_t inputSize, int level=Z_DEFAULT_COMPRESSION, const ConDictionary* dictionary=nullptr) {
 
     std::vector<uint8_t> output;
     std::vector<uint8_t> buffer(64 * 1024);
@@ -27,14 +309,19 @@ std::vector<uint8_t> zcompress(std::vector<uint8_t> input) {
     stream.zfree = Z_NULL;
     stream.opaque = Z_NULL;
 
-    int ret = deflateInit(&stream, Z_DEFAULT_COMPRESSION);
+    int ret = deflateInit(&stream, level);
     if (ret != Z_OK) {
-        std::cerr << "Failed to initialize deflate stream, error: " << ret << std::endl;
+        ConLog() << "Failed to initialize deflate stream, error: " << ret;
+        return {};
+    }
+    if (dictionary && (ret = deflateSetDictionary(&stream, dictionary->data.data(), dictionary->data.size())) != Z_OK) {
+        ConLog() << "Failed to set compression dictionary, error: " << ret;
+        deflateEnd(&stream);
         return {};
     }
 
-    stream.avail_in = input.size();
-    stream.next_in = input.data();
+    stream.avail_in = inputSize;
+    stream.next_in = (Bytef*)input;
 
     do {
         stream.avail_out = buffer.size();
@@ -43,7 +330,7 @@ std::vector<uint8_t> zcompress(std::vector<uint8_t> input) {
         ret = deflate(&stream, stream.avail_in == 0 ? Z_FINISH : Z_NO_FLUSH);
 
         if (ret != Z_OK && ret != Z_STREAM_END) {
-            std::cerr << "Failed to compress data, error: " << ret << std::endl;
+            ConLog() << "Failed to compress data, error: " << ret;
             deflateEnd(&stream);
             return {};
         }
@@ -53,26 +340,41 @@ std::vector<uint8_t> zcompress(std::vector<uint8_t> input) {
 
     deflateEnd(&stream);
 
-    if (input.size() < output.size()) {
-        std::cout << "INEFFICIENT COMPRESSION" << std::endl;
-    }
-
     return output;
 }
 
-std::vector<uint8_t> zdecompress(std::vector<uint8_t> input) {
+std::vector<uint8_t> zcompress(std::vector<uint8_t> input) {
+    return zcompress(input.data(), input.size());
+}
+
+// zlib asks for the dictionary once it reaches the start of the data, nullptr if there is none
+// returns the result of inflate, after setting the dictionary if it was asked for
+int conInflate(z_stream& stream, const ConDictionary* dictionary) {
+    int ret = inflate(&stream, Z_NO_FLUSH);
+    if (ret == Z_NEED_DICT && dictionary) {
+        ret = inflateSetDictionary(&stream, dictionary->data.data(), dictionary->data.size());
+        if (ret == Z_OK) {
+            ret = inflate(&stream, Z_NO_FLUSH);
+        }
+    }
+    return ret;
+}
+
+// rawSize is only used to size the output up front, 0 if unknown
+std::vector<uint8_t> zdecompress(const uint8_t* input, size_t inputSize, size_t rawSize=0, const ConDictionary* dictionary=nullptr) {
     std::vector<uint8_t> output;
+    output.reserve(rawSize);
     std::vector<uint8_t> buffer(64 * 1024);
     z_stream stream{};
     stream.zalloc = Z_NULL;
     stream.zfree = Z_NULL;
     stream.opaque = Z_NULL;
-    stream.avail_in = input.size();
-    stream.next_in = input.data();
+    stream.avail_in = inputSize;
+    stream.next_in = (Bytef*)input;
 
     int ret = inflateInit(&stream);
     if (ret != Z_OK) {
-        std::cerr << "Failed to initialize inflate stream, error: " << ret << std::endl;
+        ConLog() << "Failed to initialize inflate stream, error: " << ret;
         return {};
     }
 
@@ -80,13 +382,13 @@ std::vector<uint8_t> zdecompress(std::vector<uint8_t> input) {
         stream.avail_out = buffer.size();
         stream.next_out = buffer.data();
 
-        ret = inflate(&stream, Z_NO_FLUSH);
+        ret = conInflate(stream, dictionary);
 
         if (ret == Z_STREAM_END) {
             output.insert(output.end(), buffer.begin(), buffer.begin() + (buffer.size() - stream.avail_out));
             break; // End of stream
         } else if (ret != Z_OK) {
-            std::cerr << "Failed to decompress data, error: " << ret << std::endl;
+            ConLog() << "Failed to decompress data, error: " << ret;
             inflateEnd(&stream);
             return {};
         }
@@ -99,374 +401,3659 @@ std::vector<uint8_t> zdecompress(std::vector<uint8_t> input) {
     return output;
 }
 
-enum class ConType : uint8_t {
-    Null,
-    Boolean,
-    Integer,
-    Float,
-    String,
-    Array,
-    Object
-    #define CON_TYPE_Null void
-    #define CON_TYPE_Boolean bool
-    #define CON_TYPE_Integer int64_t
-    #define CON_TYPE_Float double
-    #define CON_TYPE_String std::string
-    #define CON_TYPE_Array ConArray
-    #define CON_TYPE_Object ConObject
-};
-
-struct ConObject;
-struct ConArray;
-
-#define CON_CAST(value, type) (*((CON_TYPE_##type*)(value).data))
-
-struct ConValue {
-    ConType type;
-    void* data;
-
-    ConValue() : type(ConType::Null), data(nullptr) {}
-    ConValue(bool value) : type(ConType::Boolean), data(new bool(value)) {}
-    ConValue(int64_t value) : type(ConType::Integer), data(new int64_t(value)) {}
-    ConValue(double value) : type(ConType::Float), data(new double(value)) {}
-    ConValue(std::string value) : type(ConType::String), data(new std::string(value)) {}
-    ConValue(ConArray* value);
-    ConValue(ConObject* value);
-
-    ConValue(const ConValue& other);
+std::vector<uint8_t> zdecompress(std::vector<uint8_t> input) {
+    return zdecompress(input.data(), input.size());
+}
 
+// compression codecs, the id is stored in the byte in front of every compressed value (0 means uncompressed)
+// version 0 documents can only use zlib
+enum class ConCodecId : uint8_t {
+    None,
+    Zlib,
+    Zstd,
+    Lz4
+};
 
-    void write(std::ostream& stream, uint64_t level=0);
+// passing this as the level picks the default level of the codec
+const static int CON_LEVEL_DEFAULT = -1;
 
-    void read(std::istream& stream);
+struct ConCodec {
+    ConCodecId id;
+    const char* name;
+    // both return an empty vector on failure, `dictionary` is nullptr if the document doesn't use one
+    std::vector<uint8_t> (*compress)(const uint8_t* input, size_t inputSize, int level, const ConDictionary* dictionary);
+    // rawSize is the decompressed size if the document stores it (version 1+), 0 otherwise
+    std::vector<uint8_t> (*decompress)(const uint8_t* input, size_t inputSize, size_t rawSize, const ConDictionary* dictionary);
+    // the most the codec can expand its input, a stored rawSize above it is rejected before anything is allocated
+    uint64_t maxRatio;
 };
 
-struct ConArray {
-    std::vector<ConValue> values;
-
-    ConValue& operator[](size_t index) {
-        return values[index];
+#ifdef CONFILE_WITH_ZSTD
+std::vector<uint8_t> zstdCompress(const uint8_t* input, size_t inputSize, int level, const ConDictionary* dictionary) {
+    std::vector<uint8_t> output(ZSTD_compressBound(inputSize));
+    level = level == CON_LEVEL_DEFAULT ? ZSTD_CLEVEL_DEFAULT : level;
+    size_t size;
+    if (dictionary) {
+        // contexts are kept around per thread, so small values don't pay for setting one up
+        thread_local std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx*)> context(ZSTD_createCCtx(), ZSTD_freeCCtx);
+        size = ZSTD_compress_usingCDict(context.get(), output.data(), output.size(), input, inputSize, dictionary->zstdCompression(level));
+    } else {
+        size = ZSTD_compress(output.data(), output.size(), input, inputSize, level);
     }
+    if (ZSTD_isError(size)) {
+        ConLog() << "Failed to compress data, error: " << ZSTD_getErrorName(size);
+        return {};
+    }
+    output.resize(size);
+    return output;
+}
 
-    void write(std::ostream& stream, uint64_t level) {
-        uint64_t size = values.size();
-        stream.write((char*)&size, sizeof(uint64_t));
-        for (ConValue& value : values) {
-            value.write(stream, level+1);
+std::vector<uint8_t> zstdDecompress(const uint8_t* input, size_t inputSize, size_t rawSize, const ConDictionary* dictionary) {
+    if (rawSize == 0) {
+        unsigned long long frameSize = ZSTD_getFrameContentSize(input, inputSize);
+        if (frameSize == ZSTD_CONTENTSIZE_ERROR || frameSize == ZSTD_CONTENTSIZE_UNKNOWN) {
+            ConLog() << "Failed to decompress data: unknown size";
+            return {};
         }
+        rawSize = frameSize;
+    }
+    std::vector<uint8_t> output(rawSize);
+    size_t size;
+    if (dictionary) {
+        thread_local std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx*)> context(ZSTD_createDCtx(), ZSTD_freeDCtx);
+        size = ZSTD_decompress_usingDDict(context.get(), output.data(), output.size(), input, inputSize, dictionary->zstdDecompression());
+    } else {
+        size = ZSTD_decompress(output.data(), output.size(), input, inputSize);
     }
+    if (ZSTD_isError(size)) {
+        ConLog() << "Failed to decompress data, error: " << ZSTD_getErrorName(size);
+        return {};
+    }
+    output.resize(size);
+    return output;
+}
+#endif
 
-    void read(std::istream& stream) {
-        uint64_t size;
-        stream.read((char*)&size, sizeof(uint64_t));
-        for (size_t i = 0; i < size; i++) {
-            ConValue value;
-            value.read(stream);
-            values.push_back(value);
+#ifdef CONFILE_WITH_LZ4
+// lz4 only looks back 64kb, so only the end of a dictionary is used
+const static size_t CON_LZ4_DICTIONARY_SIZE = 64 * 1024;
+
+// levels above 1 use the slower high compression mode
+std::vector<uint8_t> lz4Compress(const uint8_t* input, size_t inputSize, int level, const ConDictionary* dictionary) {
+    if (inputSize > LZ4_MAX_INPUT_SIZE) {
+        ConLog() << "Failed to compress data: too large for lz4";
+        return {};
+    }
+    std::vector<uint8_t> output(LZ4_compressBound(inputSize));
+    int size;
+    if (dictionary) {
+        size_t dictionarySize = std::min(dictionary->data.size(), CON_LZ4_DICTIONARY_SIZE);
+        const char* dictionaryData = (const char*)dictionary->data.data() + dictionary->data.size() - dictionarySize;
+        if (level > 1) {
+            LZ4_streamHC_t* stream = LZ4_createStreamHC();
+            LZ4_setCompressionLevel(stream, level);
+            LZ4_loadDictHC(stream, dictionaryData, dictionarySize);
+            size = LZ4_compress_HC_continue(stream, (const char*)input, (char*)output.data(), inputSize, output.size());
+            LZ4_freeStreamHC(stream);
+        } else {
+            LZ4_stream_t* stream = LZ4_createStream();
+            LZ4_loadDict(stream, dictionaryData, dictionarySize);
+            size = LZ4_compress_fast_continue(stream, (const char*)input, (char*)output.data(), inputSize, output.size(), 1);
+            LZ4_freeStream(stream);
         }
+    } else if (level > 1) {
+        size = LZ4_compress_HC((const char*)input, (char*)output.data(), inputSize, output.size(), level);
+    } else {
+        size = LZ4_compress_default((const char*)input, (char*)output.data(), inputSize, output.size());
     }
-};
-
-struct ConObject {
-    std::map<std::string, ConValue> values;
+    if (size <= 0) {
+        ConLog() << "Failed to compress data";
+        return {};
+    }
+    output.resize(size);
+    return output;
+}
 
-    ConValue& operator[](std::string key) {
-        return values[key];
+// lz4 blocks don't store their size, so this needs rawSize
+std::vector<uint8_t> lz4Decompress(const uint8_t* input, size_t inputSize, size_t rawSize, const ConDictionary* dictionary) {
+    std::vector<uint8_t> output(rawSize);
+    int size;
+    if (dictionary) {
+        size_t dictionarySize = std::min(dictionary->data.size(), CON_LZ4_DICTIONARY_SIZE);
+        const char* dictionaryData = (const char*)dictionary->data.data() + dictionary->data.size() - dictionarySize;
+        size = LZ4_decompress_safe_usingDict((const char*)input, (char*)output.data(), inputSize, rawSize, dictionaryData, dictionarySize);
+    } else {
+        size = LZ4_decompress_safe((const char*)input, (char*)output.data(), inputSize, rawSize);
+    }
+    if (size < 0 || (size_t)size != rawSize) {
+        ConLog() << "Failed to decompress data, error: " << size;
+        return {};
     }
+    return output;
+}
+#endif
 
-    ConValue& operator[](const char* key) {
-        return values[key];
+// nullptr if the codec isn't available, zstd and lz4 have to be enabled with CONFILE_WITH_ZSTD / CONFILE_WITH_LZ4
+const ConCodec* conCodec(ConCodecId id) {
+    const static ConCodec zlibCodec = {
+        ConCodecId::Zlib, "zlib",
+        [](const uint8_t* input, size_t inputSize, int level, const ConDictionary* dictionary) {
+            return zcompress(input, inputSize, level == CON_LEVEL_DEFAULT ? Z_DEFAULT_COMPRESSION : level, dictionary);
+        },
+        [](const uint8_t* input, size_t inputSize, size_t rawSize, const ConDictionary* dictionary) {
+            return zdecompress(input, inputSize, rawSize, dictionary);
+        },
+        // deflate takes at least two bits for a match of 258 bytes
+        1032
+    };
+#ifdef CONFILE_WITH_ZSTD
+    // a zstd block holds at most 128kb and takes at least 4 bytes
+    const static ConCodec zstdCodec = {ConCodecId::Zstd, "zstd", zstdCompress, zstdDecompress, 32 * 1024};
+#endif
+#ifdef CONFILE_WITH_LZ4
+    // a match length takes a byte for every 255 bytes
+    const static ConCodec lz4Codec = {ConCodecId::Lz4, "lz4", lz4Compress, lz4Decompress, 255};
+#endif
+    switch (id) {
+        case ConCodecId::Zlib:
+            return &zlibCodec;
+#ifdef CONFILE_WITH_ZSTD
+        case ConCodecId::Zstd:
+            return &zstdCodec;
+#endif
+#ifdef CONFILE_WITH_LZ4
+        case ConCodecId::Lz4:
+            return &lz4Codec;
+#endif
+        default:
+            return nullptr;
     }
+}
 
-    void write(std::ostream& stream, uint64_t level) {
-        uint64_t size = values.size();
-        stream.write((char*)&size, sizeof(uint64_t));
-        for (auto& [key, value] : values) {
-            uint64_t keySize = key.size();
-            stream.write((char*)&keySize, sizeof(uint64_t));
-            stream.write(key.c_str(), keySize);
-            value.write(stream, level+1);
+// estimated entropy of the data in bits per byte (0 to 8), from a byte histogram over at most `sampleSize` bytes
+// spread evenly over the data, data close to 8 (already compressed, random) won't get any smaller
+double conEntropy(const uint8_t* data, size_t size, size_t sampleSize=4096) {
+    if (size == 0) {
+        return 0.0;
+    }
+    // sample in runs of 64 bytes so repeated patterns are still visible
+    const static size_t RUN = 64;
+    size_t step = size <= sampleSize ? RUN : (size / (sampleSize / RUN)) & ~(RUN - 1);
+    uint64_t histogram[256] = {};
+    size_t sampled = 0;
+    for (size_t start = 0; start < size; start += step) {
+        size_t end = std::min(start + RUN, size);
+        for (size_t i = start; i < end; i++) {
+            histogram[data[i]]++;
         }
+        sampled += end - start;
     }
-    void read(std::istream& stream) {
-        uint64_t size;
-        stream.read((char*)&size, sizeof(uint64_t));
-        for (size_t i = 0; i < size; i++) {
-            uint64_t keySize;
-            stream.read((char*)&keySize, sizeof(uint64_t));
-            char* buffer = new char[keySize];
-            stream.read(buffer, keySize);
-            std::string key(buffer, keySize);
-            ConValue value;
-            value.read(stream);
-            values[key] = value;
-            delete[] buffer;
+    double entropy = 0.0;
+    for (uint64_t count : histogram) {
+        if (count) {
+            double p = (double)count / sampled;
+            entropy -= p * std::log2(p);
         }
     }
-};
+    return entropy;
+}
 
+// whether `inputSize` bytes of `codec` can decompress to `rawSize` bytes (headers and trailers get some slack)
+bool conRawSizeFits(const ConCodec* codec, uint64_t inputSize, uint64_t rawSize) {
+    return rawSize / codec->maxRatio <= inputSize + 64;
+}
 
-ConValue::ConValue(ConArray* value) : type(ConType::Array), data(new ConArray(*value)) {}
-ConValue::ConValue(ConObject* value) : type(ConType::Object), data(new ConObject(*value)) {}
-ConValue::ConValue(const ConValue& other) {
-    type = other.type;
-    switch (type) {
-        case ConType::Boolean:
-            data = new bool(CON_CAST(other, Boolean));
-            break;
-        case ConType::Integer:
-            data = new int64_t(CON_CAST(other, Integer));
-            break;
-        case ConType::Float:
-            data = new double(CON_CAST(other, Float));
-            break;
-        case ConType::String:
-            data = new std::string(CON_CAST(other, String));
-            break;
-        case ConType::Array:
-            data = new ConArray(CON_CAST(other, Array));
-            break;
-        case ConType::Object:
-            data = new ConObject(CON_CAST(other, Object));
-            break;
-        default:
-            data = nullptr;
-            break;
+// decompresses a value stored with codec `id`, empty if the codec isn't available or the data is invalid
+// `dictionary` is the one of the document (see ConFormat::dictionary), the time it takes is added to `stats` if it is set
+std::vector<uint8_t> conDecompress(uint8_t id, const uint8_t* input, size_t inputSize, size_t rawSize, const ConDictionary* dictionary=nullptr, ConStats* stats=nullptr) {
+    const ConCodec* codec = conCodec((ConCodecId)id);
+    if (!codec) {
+        ConLog() << "Unsupported codec: " << (int)id;
+        return {};
+    } else if (!conRawSizeFits(codec, inputSize, rawSize)) {
+        ConLog() << "Failed to decompress data: invalid size";
+        return {};
+    }
+    auto start = std::chrono::steady_clock::now();
+    std::vector<uint8_t> output = codec->decompress(input, inputSize, rawSize, dictionary);
+    if (stats) {
+        stats->codec(start, inputSize, output.size());
     }
+    return output;
 }
 
-void ConValue::write(std::ostream& stream, uint64_t level) {
-
-    const static uint64_t COMPRESSION_THRESHOLD = 256;
-    // we might also want to only compress certain levels, for example only compress top-level data, or only a certain range of levels
-    // this can also depend on the data itself
-    // 0 is top-level, 1 is first level, 2 is second level, etc.
-    const static uint64_t COMPRESSION_LEVEL_MIN = 0;
-    const static uint64_t COMPRESSION_LEVEL_MAX = 0;
-
-#define COMPRESS_COMPARE(size) ((size) > COMPRESSION_THRESHOLD && level >= COMPRESSION_LEVEL_MIN && level <= COMPRESSION_LEVEL_MAX)
+// default size of a trained dictionary, zlib only uses the last 32kb of one
+const static size_t CON_DICTIONARY_SIZE = 16 * 1024;
 
-    // we will first write the object into a buffer, and if it is too large, we will compress it
-    // only if it is array, or object, and if it is larger than 64 bytes (todo: optimize this value)
-    // we will write the type first
-    stream.write((char*)&type, sizeof(ConType));
-
-    // then we will write whether it is compressed or not,
-    // if it is, we append the compressed byte count, then the compressed data
-    // otherwise, just write the data (size isn't needed because of how the format is designed)
-    switch (type) {
-        case ConType::Boolean:
-            stream.write((char*)data, sizeof(bool));
-            break;
-        case ConType::Integer:
-            stream.write((char*)data, sizeof(int64_t));
-            break;
-        case ConType::Float:
-            stream.write((char*)data, sizeof(double));
-            break;
-        case ConType::String: {
-            std::string str = CON_CAST(*this, String);
-            if (COMPRESS_COMPARE(str.size())) {
-                std::vector<uint8_t> compressed = zcompress(std::vector<uint8_t>(str.begin(), str.end()));
-                uint64_t size = compressed.size();
-                stream.put(1);
-                stream.write((char*)&size, sizeof(uint64_t));
-                stream.write((char*)compressed.data(), size);
-            } else {
-                uint64_t size = str.size();
-                stream.put(0);
-                stream.write((char*)&size, sizeof(uint64_t));
-                stream.write(str.c_str(), size);
-            }
-            break;
-        }
-        case ConType::Array: {
-            std::stringstream buffer;
-            ((ConArray*)data)->write(buffer, level);
-            std::string str = buffer.str();
-            if (COMPRESS_COMPARE(str.size())) {
-                std::vector<uint8_t> compressed = zcompress(std::vector<uint8_t>(str.begin(), str.end()));
-                
-                uint64_t size = compressed.size();
-                stream.put(1);
-                stream.write((char*)&size, sizeof(uint64_t));
-                stream.write((char*)compressed.data(), size);
-            } else {
-                uint64_t size = str.size();
-                stream.put(0);
-                stream.write(str.c_str(), size);
+// a raw dictionary of the byte strings that show up in the most samples, the most common ones last,
+// the end of the dictionary is the closest to the data so it is the cheapest to refer to (and all that lz4 sees)
+std::vector<uint8_t> conBuildDictionary(const std::vector<std::string_view>& samples, size_t size) {
+    // strings are found through the 8 byte sequences in them, a string takes the bytes around one of those
+    const static size_t GRAM = 8;
+    const static size_t SEGMENT = 48;
+    struct Gram {
+        uint32_t samples = 0;
+        uint32_t last = UINT32_MAX;
+        // where it was seen first
+        uint32_t sample = 0;
+        size_t offset = 0;
+        bool used = false;
+    };
+    std::unordered_map<uint64_t, Gram> grams;
+    for (uint32_t i = 0; i < samples.size(); i++) {
+        std::string_view sample = samples[i];
+        for (size_t j = 0; j + GRAM <= sample.size(); j++) {
+            uint64_t key;
+            memcpy(&key, sample.data() + j, GRAM);
+            Gram& gram = grams[key];
+            if (gram.last == i) {
+                continue;
             }
-        } break;
-        case ConType::Object: {
-            std::stringstream buffer;
-            ((ConObject*)data)->write(buffer, level);
-            std::string str = buffer.str();
-            if (COMPRESS_COMPARE(str.size())) {
-                std::vector<uint8_t> compressed = zcompress(std::vector<uint8_t>(str.begin(), str.end()));
-                uint64_t size = compressed.size();
-                stream.put(1);
-                stream.write((char*)&size, sizeof(uint64_t));
-                stream.write((char*)compressed.data(), size);
-            } else {
-                uint64_t size = str.size();
-                stream.put(0);
-                stream.write(str.c_str(), size);
+            if (gram.samples == 0) {
+                gram.sample = i;
+                gram.offset = j;
             }
-        } break;
-        default:
-            std::cerr << "Invalid type" << std::endl;
-            std::cerr << "Type: " << (int)type << std::endl;
-            break;      
+            gram.samples++;
+            gram.last = i;
+        }
     }
-}
-
-void ConValue::read(std::istream& stream) {
-    data = nullptr;
-    uint8_t type;
-    stream.read((char*)&type, sizeof(uint8_t));
-    this->type = (ConType)type;
-    switch (this->type) {
-        case ConType::Boolean:
-            data = new bool;
-            stream.read((char*)data, sizeof(bool));
-            break;
-        case ConType::Integer:
-            data = new int64_t;
-            stream.read((char*)data, sizeof(int64_t));
-            break;
-        case ConType::Float:
-            data = new double;
-            stream.read((char*)data, sizeof(double));
-            break;
-        case ConType::String: {
-            uint8_t compressed;
-            stream.read((char*)&compressed, sizeof(uint8_t));
-            uint64_t size;
-            stream.read((char*)&size, sizeof(uint64_t));
-            char* buffer = new char[size];
-            stream.read(buffer, size);
-            if (compressed) {
-                std::vector<uint8_t> compressed(buffer, buffer + size);
-                std::vector<uint8_t> decompressed = zdecompress(compressed);
-                std::string str(decompressed.begin(), decompressed.end());
-                data = new std::string(str);
-
-            } else {
-                std::string str(buffer, buffer + size);
-                data = new std::string(str);
-            }
-            delete[] buffer;
-            break;
+    // sequences in only one sample don't help the others
+    std::vector<std::pair<uint32_t, uint64_t>> order;
+    for (const auto& [key, gram] : grams) {
+        if (gram.samples > 1) {
+            order.emplace_back(gram.samples, key);
         }
-        case ConType::Array: {
-            uint8_t compressed;
-            stream.read((char*)&compressed, sizeof(uint8_t));
-            if (compressed) {
-                uint64_t size;
-                stream.read((char*)&size, sizeof(uint64_t));
-                char* buffer = new char[size];
-                stream.read(buffer, size);
-                std::vector<uint8_t> compressed(buffer, buffer + size);
-                std::vector<uint8_t> decompressed = zdecompress(compressed);
-                std::string str(decompressed.begin(), decompressed.end());
-                std::stringstream bufferStream(str);
-                ConArray* arr = new ConArray;
-                arr->read(bufferStream);
-                data = arr;
-                delete[] buffer;
-
-            } else {
-                ConArray* arr = new ConArray;
-                arr->read(stream);
-                data = arr;
-            }
+    }
+    std::sort(order.begin(), order.end(), std::greater<>());
+    std::vector<std::string_view> segments;
+    size_t total = 0;
+    for (const auto& [count, key] : order) {
+        if (total >= size) {
             break;
         }
-        case ConType::Object: {
-            uint8_t compressed;
-            stream.read((char*)&compressed, sizeof(uint8_t));
-            if (compressed) {
-                uint64_t size;
-                stream.read((char*)&size, sizeof(uint64_t));
-                // char* buffer = new char[size];
-                // stream.read(buffer, size);
-                // std::vector<uint8_t> compressed(buffer, buffer + size);
-                // for some reason this only is loading 19 of the correct compressed bytes, and the rest is random unitialized memory (I think, since it is random data, some are wierd strings (debug data probably))
-                // lets test where we are in the file, and how many bytes are left in the file
-
-                std::vector<uint8_t> compressed(size);
-                stream.read((char*)compressed.data(), size);
-                std::vector<uint8_t> decompressed = zdecompress(compressed);
-                std::string str(decompressed.begin(), decompressed.end());
-                std::stringstream bufferStream(str);
-                ConObject* obj = new ConObject;
-                obj->read(bufferStream);
-                data = obj;
-            } else {
-                ConObject* obj = new ConObject;
-                obj->read(stream);
-                data = obj;
+        const Gram& gram = grams[key];
+        if (gram.used) {
+            continue;
+        }
+        std::string_view sample = samples[gram.sample];
+        // starts a bit in front of the sequence, so what comes before it is in there too
+        size_t begin = gram.offset - std::min(gram.offset, SEGMENT / 4);
+        std::string_view segment = sample.substr(begin, std::min(SEGMENT, size - total));
+        for (size_t j = 0; j + GRAM <= segment.size(); j++) {
+            uint64_t inner;
+            memcpy(&inner, segment.data() + j, GRAM);
+            auto it = grams.find(inner);
+            if (it != grams.end()) {
+                it->second.used = true;
             }
-            break;
         }
+        segments.push_back(segment);
+        total += segment.size();
     }
+    std::vector<uint8_t> dictionary;
+    dictionary.reserve(total);
+    for (auto it = segments.rbegin(); it != segments.rend(); ++it) {
+        dictionary.insert(dictionary.end(), it->begin(), it->end());
+    }
+    return dictionary;
 }
 
-// converting con to json
-
-std::ostream& operator<<(std::ostream& os, ConValue& value);
-
-std::ostream& operator<<(std::ostream& os, ConArray& arr) {
-    os << "[";
-    for (size_t i = 0; i < arr.values.size(); i++) {
-        os << arr.values[i];
-        if (i < arr.values.size() - 1) {
-            os << ", ";
+// trains the content of a dictionary (see ConDictionary) of at most `size` bytes for `codec`,
+// on samples of the data that will be compressed with it
+// zstd dictionaries are trained by zstd itself (which wants a few hundred samples), the others are built by conBuildDictionary
+std::vector<uint8_t> conTrainDictionary(const std::vector<std::string_view>& samples, [[maybe_unused]] ConCodecId codec=ConCodecId::Zlib, size_t size=CON_DICTIONARY_SIZE) {
+#ifdef CONFILE_WITH_ZSTD
+    if (codec == ConCodecId::Zstd) {
+        std::string joined;
+        std::vector<size_t> sizes;
+        for (std::string_view sample : samples) {
+            joined.append(sample);
+            sizes.push_back(sample.size());
         }
+        std::vector<uint8_t> dictionary(size);
+        size_t trained = ZDICT_trainFromBuffer(dictionary.data(), dictionary.size(), joined.data(), sizes.data(), sizes.size());
+        if (!ZDICT_isError(trained)) {
+            dictionary.resize(trained);
+            return dictionary;
+        }
+        ConLog(ConLogLevel::Warning) << "Failed to train zstd dictionary, error: " << ZDICT_getErrorName(trained) << ", building a raw one";
     }
-    os << "]";
-    return os;
+#endif
+    return conBuildDictionary(samples, size);
 }
 
-std::ostream& operator<<(std::ostream& os, ConObject& obj) {
-    os << "{";
-    for (auto& [key, value] : obj.values) {
-        os << '"' << key << "\": " << value;
-        if (&obj.values[key] != &obj.values.rbegin()->second) {
-            os << ", ";
-        }
+// read-only streambuf over memory, lets the stream based reader decode straight out of a buffer
+struct ConMemoryBuffer : std::streambuf {
+    ConMemoryBuffer(const void* data, size_t size) {
+        char* begin = (char*)data;
+        setg(begin, begin, begin + size);
     }
-    os << "}";
-    return os;
+};
+
+// streambuf that inflates `size` bytes of zlib data from `source` through fixed size windows,
+// so compressed values are decoded while they are parsed instead of being inflated all at once
+struct ConInflateBuffer : std::streambuf {
+    const static size_t WINDOW = 64 * 1024;
+
+    // `dictionary` is the one of the document (see ConFormat::dictionary), the time spent inflating is added to `stats` if it is set
+    ConInflateBuffer(std::istream& source, uint64_t size, const ConDictionary* dictionary=nullptr, ConStats* stats=nullptr)
+        : source(source), remaining(size), input(WINDOW), output(WINDOW), dictionary(dictionary), stats(stats) {
+        int ret = inflateInit(&stream);
+        if (ret != Z_OK) {
+            ConLog() << "Failed to initialize inflate stream, error: " << ret;
+            failed = true;
+        }
+    }
+    ConInflateBuffer(const ConInflateBuffer&) = delete;
+    ConInflateBuffer& operator=(const ConInflateBuffer&) = delete;
+
+    ~ConInflateBuffer() {
+        inflateEnd(&stream);
+    }
+
+    // false if the data was corrupt or cut off, or the end of the zlib stream wasn't reached (see finish)
+    bool good() const {
+        return ended && !failed;
+    }
+
+    // inflates up to the end of the zlib stream, so its checksum is verified even if the reader
+    // didn't need the rest of the output, and skips the compressed bytes after it, so the source
+    // ends up right after them
+    void finish() {
+        setg(nullptr, nullptr, nullptr);
+        while (underflow() != traits_type::eof()) {
+            setg(nullptr, nullptr, nullptr);
+        }
+        source.ignore(remaining);
+        if (!failed && (uint64_t)source.gcount() != remaining) {
+            ConLog() << "Failed to decompress data: unexpected end of input";
+            failed = true;
+        }
+        remaining = 0;
+    }
+
+protected:
+    int_type underflow() override {
+        if (gptr() < egptr()) {
+            return traits_type::to_int_type(*gptr());
+        }
+        while (!ended && !failed) {
+            if (stream.avail_in == 0 && remaining > 0) {
+                source.read(input.data(), std::min<uint64_t>(remaining, (uint64_t)WINDOW));
+                size_t read = source.gcount();
+                if (read == 0) {
+                    ConLog() << "Failed to decompress data: unexpected end of input";
+                    failed = true;
+                    break;
+                }
+                remaining -= read;
+                stream.next_in = (Bytef*)input.data();
+                stream.avail_in = read;
+            }
+            stream.next_out = (Bytef*)output.data();
+            stream.avail_out = WINDOW;
+            auto start = std::chrono::steady_clock::now();
+            uInt available = stream.avail_in;
+            int ret = conInflate(stream, dictionary);
+            if (stats) {
+                stats->codec(start, available - stream.avail_in, WINDOW - stream.avail_out);
+            }
+            if (ret == Z_STREAM_END) {
+                ended = true;
+            } else if (ret != Z_OK) {
+                ConLog() << "Failed to decompress data, error: " << ret;
+                failed = true;
+            }
+            size_t produced = WINDOW - stream.avail_out;
+            if (produced) {
+                setg(output.data(), output.data(), output.data() + produced);
+                return traits_type::to_int_type(*gptr());
+            }
+        }
+        return traits_type::eof();
+    }
+
+private:
+    std::istream& source;
+    uint64_t remaining;
+    std::vector<char> input;
+    std::vector<char> output;
+    z_stream stream{};
+    bool ended = false;
+    bool failed = false;
+    const ConDictionary* dictionary;
+    ConStats* stats;
+};
+
+// reads a whole compressed string out of `inflater`, `rawSize` is 0 if it isn't known (version 0)
+template<typename String>
+bool conInflateString(ConInflateBuffer& inflater, uint64_t rawSize, String& out) {
+    // grown a window at a time, so a broken rawSize fails once the data runs out instead of being allocated
+    uint64_t size = 0;
+    while (!rawSize || size < rawSize) {
+        uint64_t window = ConInflateBuffer::WINDOW;
+        size_t piece = rawSize ? std::min(rawSize - size, window) : window;
+        out.resize(size + piece);
+        size_t read = inflater.sgetn(out.data() + size, piece);
+        size += read;
+        if (read < piece) {
+            break;
+        }
+    }
+    out.resize(size);
+    if (rawSize && size != rawSize) {
+        return false;
+    }
+    inflater.finish();
+    return inflater.good();
+}
+
+// format versions
+// 0: the original format, there is no header and uncompressed arrays/objects don't store their size
+// 1: starts with a header, every string/array/object stores its encoded byte size (and compressed ones
+//    their decompressed size too), so readers can skip any value without parsing it
+const static uint8_t CON_VERSION_LATEST = 1;
+
+// optional parts of the format (version 1+), recorded in the header
+enum ConFlags : uint32_t {
+    // arrays and objects store the offset of every element/entry in front of them,
+    // relative to where the first one starts
+    CON_FLAG_OFFSETS = 1 << 0,
+    // objects store a sorted index of (key prefix, entry offset) pairs in front of their entries,
+    // so a key can be found with a binary search over the index without touching the entries
+    // (replaces the offset table for objects)
+    CON_FLAG_KEY_INDEX = 1 << 1,
+    // sizes, counts and key lengths are LEB128 varints, integers are zigzag varints,
+    // booleans and integers from 0 to 127 are folded into the type byte (see CON_TAG_*)
+    // byte sizes of uncompressed arrays/objects and offset tables stay fixed width, so they can still be patched/indexed
+    CON_FLAG_COMPACT = 1 << 2,
+    // every distinct object key is stored once, sorted, in a dictionary after the header,
+    // objects refer to their keys by index (so comparing indices orders them like the keys)
+    CON_FLAG_KEY_DICTIONARY = 1 << 3,
+    // strings, arrays and objects that occur more than once are stored once, in a table after the header
+    // (and the key dictionary): their count, then the byte size and encoding of each of them,
+    // every occurrence is a CON_TAG_REFERENCE followed by the index of its subtree (a size)
+    // subtrees in the table only refer to the ones before them
+    CON_FLAG_SHARED = 1 << 4,
+    // every compressed value is compressed with a dictionary (see ConDictionary), whose id follows the flags
+    // (as a fixed width uint32), readers need the dictionary registered to read the document
+    CON_FLAG_DICTIONARY = 1 << 5,
+};
+
+// type bytes that only appear in compact documents, next to the ConType values
+const static uint8_t CON_TAG_FALSE = 0x10;
+const static uint8_t CON_TAG_TRUE = 0x11;
+// 0x80 | value, for integers from 0 to 127
+const static uint8_t CON_TAG_SMALL_INTEGER = 0x80;
+// stands for a subtree of the shared table, in documents with CON_FLAG_SHARED
+const static uint8_t CON_TAG_REFERENCE = 0x12;
+
+// version 1+: stored in place of the codec id of an array whose elements are split into blocks
+// (see ConWriteOptions::blockElements), followed by
+//   the byte size of the rest of the array (fixed width), the element count, the block count,
+//   a block index of (offset relative to the first block, index of the block's first element) pairs (fixed width),
+//   then every block: its codec id, stored size (and decompressed size if compressed) and its elements back to back
+// blocks are compressed on their own, so they can be decoded in parallel and each of them can be read without the others
+const static uint8_t CON_BLOCKED = 0xff;
+
+// version 1+: stored in place of the codec id of an array of objects that all have the same keys
+// (see ConWriteOptions::columnar), followed by
+//   the byte size of the rest of the array (fixed width), the row count, the field count, the key of every field,
+//   then a column for every field: its kind (see ConColumn), codec id, stored size (and decompressed size if compressed)
+//   and its data, every column is compressed on its own
+const static uint8_t CON_COLUMNAR = 0xfe;
+
+// version 1+: stored in place of the codec id of an array of at least two integers, floats or booleans
+// (nulls are allowed in between, see ConWriteOptions::packed), followed by
+//   the byte size of the rest of the array (fixed width), the element count,
+//   then the elements as one column (see ConColumn and CON_COLUMNAR)
+// the numbers are fixed width and can be used in place, without a type byte for every element
+const static uint8_t CON_PACKED = 0xfd;
+
+uint64_t conZigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+int64_t conUnzigzag(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+bool conReadVarint(const uint8_t*& p, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        uint8_t byte = *p++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// `consumed` (if given) is increased by the number of bytes that were read
+bool conReadVarint(std::istream& stream, uint64_t& value, size_t* consumed=nullptr) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = stream.get();
+        if (byte == EOF) {
+            return false;
+        }
+        if (consumed) {
+            (*consumed)++;
+        }
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    stream.setstate(std::ios::failbit);
+    return false;
+}
+
+// appends `size` bytes of the stream to `out`, in pieces, so a broken size fails once the stream ends
+// instead of allocating all of it up front
+template<typename Buffer>
+bool conReadBytes(std::istream& stream, Buffer& out, uint64_t size) {
+    const static uint64_t PIECE = 64 * 1024;
+    for (uint64_t left = size; left > 0;) {
+        size_t piece = std::min(left, PIECE);
+        out.resize(out.size() + piece);
+        if (!stream.read((char*)out.data() + out.size() - piece, piece)) {
+            return false;
+        }
+        left -= piece;
+    }
+    return true;
+}
+
+// the first 8 bytes of a key packed big-endian (zero padded), so comparing prefixes
+// orders keys the same way comparing the keys does
+uint64_t conKeyPrefix(std::string_view key) {
+    uint64_t prefix = 0;
+    for (size_t i = 0; i < sizeof(uint64_t); i++) {
+        prefix <<= 8;
+        if (i < key.size()) {
+            prefix |= (uint8_t)key[i];
+        }
+    }
+    return prefix;
+}
+
+// describes how a document is encoded, stored in its header ("CON", version, flags, the id of the compression dictionary
+// and then the key dictionary if there are those)
+// version 0 documents have no header, their first byte is the type of the top-level value
+struct ConFormat {
+    const static size_t HEADER_SIZE = 3 + sizeof(uint8_t) + sizeof(uint32_t);
+
+    uint8_t version = 0;
+    uint32_t flags = 0;
+    // see CON_FLAG_DICTIONARY, nullptr if the document doesn't use one
+    std::shared_ptr<const ConDictionary> dictionary;
+    // see CON_FLAG_KEY_DICTIONARY
+    std::vector<std::string> keys;
+    // offset and byte size of every shared subtree (see CON_FLAG_SHARED), relative to sharedData
+    // if the header was read from a stream, otherwise to the start of the document
+    std::vector<std::pair<size_t, size_t>> shared;
+    std::vector<uint8_t> sharedData;
+    const uint8_t* document = nullptr;
+    // bytes in front of the top-level value
+    size_t size = 0;
+
+    bool has(uint32_t flag) const {
+        return (flags & flag) != 0;
+    }
+
+    // size of the header in front of the top-level value
+    size_t headerSize() const {
+        return size;
+    }
+
+    // reads the header if there is one
+    bool read(std::istream& stream) {
+        *this = {};
+        if (stream.peek() != 'C') {
+            return (bool)stream;
+        }
+        uint8_t header[HEADER_SIZE];
+        stream.read((char*)header, HEADER_SIZE);
+        if (!stream || !readFixed(header, HEADER_SIZE)) {
+            return false;
+        }
+        size = HEADER_SIZE;
+        if (has(CON_FLAG_DICTIONARY)) {
+            uint32_t id;
+            if (!stream.read((char*)&id, sizeof(uint32_t)) || !findDictionary(id)) {
+                return false;
+            }
+            size += sizeof(uint32_t);
+        }
+        if (has(CON_FLAG_KEY_DICTIONARY)) {
+            uint64_t count;
+            if (!readSize(stream, count, &size)) {
+                return false;
+            }
+            for (uint64_t i = 0; i < count; i++) {
+                uint64_t keySize;
+                if (!readSize(stream, keySize, &size)) {
+                    return false;
+                }
+                if (!conReadBytes(stream, keys.emplace_back(), keySize)) {
+                    return false;
+                }
+                size += keySize;
+            }
+        }
+        if (has(CON_FLAG_SHARED)) {
+            uint64_t count;
+            if (!readSize(stream, count, &size)) {
+                return false;
+            }
+            for (uint64_t i = 0; i < count; i++) {
+                uint64_t valueSize;
+                if (!readSize(stream, valueSize, &size)) {
+                    return false;
+                }
+                // read in pieces, so a broken size fails once the stream ends instead of allocating all of it
+                size_t offset = sharedData.size();
+                for (uint64_t left = valueSize; left > 0 && stream;) {
+                    size_t piece = std::min<uint64_t>(left, 1 << 16);
+                    sharedData.resize(sharedData.size() + piece);
+                    stream.read((char*)sharedData.data() + sharedData.size() - piece, piece);
+                    left -= piece;
+                }
+                if (!stream) {
+                    return false;
+                }
+                size += valueSize;
+                shared.emplace_back(offset, valueSize);
+            }
+        }
+        return true;
+    }
+
+    bool read(const uint8_t* data, size_t dataSize) {
+        *this = {};
+        if (dataSize == 0 || data[0] != 'C') {
+            return true;
+        }
+        if (!readFixed(data, dataSize)) {
+            return false;
+        }
+        const uint8_t* p = data + HEADER_SIZE;
+        const uint8_t* end = data + dataSize;
+        if (has(CON_FLAG_DICTIONARY)) {
+            uint32_t id;
+            if ((size_t)(end - p) < sizeof(uint32_t)) {
+                ConLog() << "Invalid header";
+                return false;
+            }
+            memcpy(&id, p, sizeof(uint32_t));
+            p += sizeof(uint32_t);
+            if (!findDictionary(id)) {
+                return false;
+            }
+        }
+        if (has(CON_FLAG_KEY_DICTIONARY)) {
+            uint64_t count;
+            if (!readSize(p, end, count)) {
+                return false;
+            }
+            for (uint64_t i = 0; i < count; i++) {
+                uint64_t keySize;
+                if (!readSize(p, end, keySize) || keySize > (uint64_t)(end - p)) {
+                    ConLog() << "Invalid key dictionary";
+                    return false;
+                }
+                keys.emplace_back((const char*)p, keySize);
+                p += keySize;
+            }
+        }
+        if (has(CON_FLAG_SHARED)) {
+            uint64_t count;
+            if (!readSize(p, end, count)) {
+                return false;
+            }
+            document = data;
+            for (uint64_t i = 0; i < count; i++) {
+                uint64_t valueSize;
+                if (!readSize(p, end, valueSize) || valueSize > (uint64_t)(end - p)) {
+                    ConLog() << "Invalid shared table";
+                    return false;
+                }
+                shared.emplace_back(p - data, valueSize);
+                p += valueSize;
+            }
+        }
+        size = p - data;
+        return true;
+    }
+
+    // the encoding of shared subtree i, nullptr if there is no such subtree
+    const uint8_t* sharedValue(uint64_t i, size_t& valueSize) const {
+        if (i >= shared.size()) {
+            return nullptr;
+        }
+        valueSize = shared[i].second;
+        return (document ? document : sharedData.data()) + shared[i].first;
+    }
+
+    // sizes, counts and key lengths, see ConWriter::writeSize
+    bool readSize(std::istream& stream, uint64_t& value, size_t* consumed=nullptr) const {
+        if (has(CON_FLAG_COMPACT)) {
+            return conReadVarint(stream, value, consumed);
+        }
+        stream.read((char*)&value, sizeof(uint64_t));
+        if (consumed) {
+            *consumed += stream.gcount();
+        }
+        return (bool)stream;
+    }
+
+    bool readSize(const uint8_t*& p, const uint8_t* end, uint64_t& value) const {
+        if (has(CON_FLAG_COMPACT)) {
+            return conReadVarint(p, end, value);
+        }
+        if ((size_t)(end - p) < sizeof(uint64_t)) {
+            return false;
+        }
+        memcpy(&value, p, sizeof(uint64_t));
+        p += sizeof(uint64_t);
+        return true;
+    }
+
+private:
+    bool findDictionary(uint32_t id) {
+        dictionary = conFindDictionary(id);
+        if (!dictionary) {
+            ConLog() << "Unknown compression dictionary: " << id << " (see conRegisterDictionary)";
+            return false;
+        }
+        return true;
+    }
+
+    bool readFixed(const uint8_t* data, size_t dataSize) {
+        if (dataSize < HEADER_SIZE || data[0] != 'C' || data[1] != 'O' || data[2] != 'N') {
+            ConLog() << "Invalid header";
+            return false;
+        }
+        version = data[3];
+        memcpy(&flags, data + 4, sizeof(uint32_t));
+        if (version > CON_VERSION_LATEST) {
+            ConLog() << "Unsupported version: " << (int)version;
+            return false;
+        }
+        return true;
+    }
+};
+
+struct ConArray;
+// a fixed set of worker threads running tasks in the order they were submitted
+struct ConThreadPool {
+    ConThreadPool(size_t count) {
+        for (size_t i = 0; i < std::max<size_t>(count, 1); i++) {
+            workers.emplace_back([this] { work(); });
+        }
+    }
+    ConThreadPool(const ConThreadPool&) = delete;
+    ConThreadPool& operator=(const ConThreadPool&) = delete;
+
+    ~ConThreadPool() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    size_t size() const {
+        return workers.size();
+    }
+
+    std::future<void> submit(std::function<void()> task) {
+        std::packaged_task<void()> packaged(std::move(task));
+        std::future<void> future = packaged.get_future();
+        {
+            std::lock_guard lock(mutex);
+            tasks.push_back(std::move(packaged));
+        }
+        wake.notify_one();
+        return future;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::packaged_task<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void work() {
+        while (true) {
+            std::packaged_task<void()> task;
+            {
+                std::unique_lock lock(mutex);
+                wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty()) {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+};
+
+struct ConWriteOptions {
+    // see CON_VERSION_LATEST, 0 writes the original format
+    uint8_t version = 0;
+    // version 1+: see CON_FLAG_OFFSETS
+    bool offsetTable = false;
+    // version 1+: see CON_FLAG_KEY_INDEX
+    bool keyIndex = false;
+    // version 1+: see CON_FLAG_COMPACT
+    bool compact = false;
+    // version 1+: see CON_FLAG_KEY_DICTIONARY
+    bool keyDictionary = false;
+    // version 1+: repeated subtrees are stored once (see CON_FLAG_SHARED), if their encoding
+    // (estimated before compression) takes at least sharedSize bytes
+    bool shared = false;
+    uint64_t sharedSize = 64;
+    // codec used for compressed values, version 0 only supports zlib
+    ConCodecId codec = ConCodecId::Zlib;
+    // compression level, the meaning depends on the codec
+    int level = CON_LEVEL_DEFAULT;
+    // version 1+: compressed values are primed with this dictionary (see CON_FLAG_DICTIONARY),
+    // which pays off for many small documents of the same shape, see conTrainDictionary
+    std::shared_ptr<const ConDictionary> dictionary;
+
+    // compression policy, a string/array/object is compressed if all of these agree
+    // depth range of values that may be compressed, 0 is the top-level value
+    // nested values inside an already compressed one are rarely worth it, so by default only the top-level is
+    uint64_t minDepth = 0;
+    uint64_t maxDepth = 0;
+    // values need more encoded bytes than this
+    uint64_t threshold = 256;
+    // the estimated entropy (see conEntropy) has to be below this, 8 accepts everything
+    double maxEntropy = 8.0;
+    // the compressed value has to be at least this fraction smaller, otherwise it is stored uncompressed
+    double minSavings = 0.0;
+    // called last with the encoded size, for heuristics that depend on the data itself
+    // with more than one thread it is called from the worker threads
+    std::function<bool(const ConValue& value, uint64_t depth, uint64_t size)> shouldCompress;
+
+    // threads that encode and compress siblings at the same time, 0 uses every core
+    // only containers whose elements (or anything below them) can be compressed are split up,
+    // so this needs maxDepth >= 1, e.g. minDepth = maxDepth = 1 compresses every element of the top-level value on its own
+    // the output is the same as with one thread
+    unsigned threads = 1;
+
+    // version 1+: arrays are split into blocks of at most blockElements elements, a block also ends
+    // once it holds blockBytes encoded bytes, 0 turns either limit off (see CON_BLOCKED)
+    // arrays that fit into one block are written as usual, the others compress every block
+    // on its own (with the same policy as the array) instead of the whole array
+    uint64_t blockElements = 0;
+    uint64_t blockBytes = 0;
+
+    // version 1+: arrays of at least two objects that all have the same keys are stored column by column,
+    // instead of being split into blocks (see CON_COLUMNAR)
+    bool columnar = false;
+
+    // version 1+: arrays of at least two integers, floats or booleans (and nulls) are stored packed,
+    // one fixed width value after the other instead of being split into blocks (see CON_PACKED)
+    bool packed = false;
+    // version 1+: integer columns (of columnar and packed arrays) store the difference to the previous value
+    // as a zigzag varint instead of every value, which is small for sorted ids and timestamps (see CON_COLUMN_DELTA)
+    // they can't be used in place anymore, ConView expands them the first time they are accessed
+    bool delta = false;
+
+    // collects numbers about the write if set (see ConStats), it has to stay alive until the write is done
+    ConStats* stats = nullptr;
+
+    ConFormat format() const {
+        ConFormat format;
+        format.version = version;
+        if (version >= 1 && offsetTable) {
+            format.flags |= CON_FLAG_OFFSETS;
+        }
+        if (version >= 1 && keyIndex) {
+            format.flags |= CON_FLAG_KEY_INDEX;
+        }
+        if (version >= 1 && compact) {
+            format.flags |= CON_FLAG_COMPACT;
+        }
+        if (version >= 1 && keyDictionary) {
+            format.flags |= CON_FLAG_KEY_DICTIONARY;
+        }
+        if (version >= 1 && shared) {
+            format.flags |= CON_FLAG_SHARED;
+        }
+        if (version >= 1 && dictionary) {
+            format.flags |= CON_FLAG_DICTIONARY;
+            format.dictionary = dictionary;
+        }
+        return format;
+    }
+};
+
+// a growable output buffer that the whole document is encoded into in a single pass
+// headers whose contents depend on the encoded payload (sizes, compression flags) are
+// reserved up front and patched once the payload has been written
+struct ConWriter {
+    std::vector<uint8_t> buffer;
+    ConWriteOptions options;
+    ConFormat format;
+    // index of every key in format.keys
+    std::unordered_map<std::string_view, uint64_t> keyIds;
+    // see CON_FLAG_SHARED, the index of the shared subtree for every value that is written as a reference
+    std::unordered_map<const ConValue*, uint64_t> sharedIds;
+    // the encoded shared subtrees, written with the header
+    std::vector<std::vector<uint8_t>> sharedValues;
+    // the shared subtree this writer encodes for the table, it isn't replaced with a reference to itself
+    const ConValue* defining = nullptr;
+
+    // codec used for compressed values, nullptr if nothing should be compressed
+    const ConCodec* codec;
+
+    // see ConWriteOptions::threads, nullptr when encoding on one thread (and in the writers of parallel parts)
+    std::shared_ptr<ConThreadPool> pool;
+    // the writer a part is encoded for, keys are looked up there
+    const ConWriter* parent = nullptr;
+
+    ConWriter(const ConWriteOptions& options={}) : options(options), format(options.format()) {
+        if (options.threads != 1) {
+            pool = std::make_shared<ConThreadPool>(options.threads ? options.threads : std::thread::hardware_concurrency());
+        }
+        codec = options.codec == ConCodecId::None ? nullptr : conCodec(options.codec);
+        if (options.codec != ConCodecId::None && !codec) {
+            ConLog(ConLogLevel::Warning) << "Unsupported codec: " << (int)options.codec << ", falling back to zlib";
+            codec = conCodec(ConCodecId::Zlib);
+        } else if (codec && format.version == 0 && codec->id != ConCodecId::Zlib) {
+            ConLog(ConLogLevel::Warning) << "Version 0 only supports zlib, falling back to zlib";
+            codec = conCodec(ConCodecId::Zlib);
+        }
+    }
+
+    // whether values at `depth` may be compressed at all, known before they are encoded
+    bool compressible(uint64_t depth) const {
+        return codec && depth >= options.minDepth && depth <= options.maxDepth;
+    }
+
+    // whether an encoded value should be compressed
+    bool shouldCompress(const ConValue& value, uint64_t depth, const uint8_t* input, size_t inputSize) const {
+        if (!compressible(depth) || inputSize <= options.threshold) {
+            return false;
+        }
+        if (options.maxEntropy < 8.0 && conEntropy(input, inputSize) > options.maxEntropy) {
+            return false;
+        }
+        return !options.shouldCompress || options.shouldCompress(value, depth, inputSize);
+    }
+
+    // empty if compressing failed or didn't save enough (see ConWriteOptions::minSavings)
+    std::vector<uint8_t> compress(const uint8_t* input, size_t inputSize) const {
+        auto start = std::chrono::steady_clock::now();
+        const ConDictionary* dictionary = format.has(CON_FLAG_DICTIONARY) ? options.dictionary.get() : nullptr;
+        std::vector<uint8_t> compressed = codec->compress(input, inputSize, options.level, dictionary);
+        if (options.stats) {
+            options.stats->codec(start, inputSize, compressed.size());
+        }
+        if (compressed.size() > inputSize * (1.0 - options.minSavings)) {
+            return {};
+        }
+        return compressed;
+    }
+
+    // whether arrays may be split into blocks
+    bool blocking() const {
+        return format.version >= 1 && (options.blockElements || options.blockBytes);
+    }
+
+    // rewrites an encoded array as blocks (see CON_BLOCKED), its elements start at `starts` and end with the buffer
+    // `header` is the offset of its codec byte, false if the elements fit into one block and were left alone
+    bool writeBlocks(const ConValue& value, uint64_t level, size_t header, const std::vector<size_t>& starts);
+
+    // whether an array should be stored column by column
+    bool columnar(const ConArray& array) const;
+
+    // writes the codec byte and payload of an array column by column (see CON_COLUMNAR)
+    void writeColumns(ConValue& value, uint64_t level);
+
+    // whether an array should be stored packed
+    bool packable(const ConArray& array) const;
+
+    // writes the codec byte and payload of a packed array (see CON_PACKED)
+    void writePacked(ConValue& value, uint64_t level);
+
+    // encodes the values `cell(0)` to `cell(rows - 1)` as one column, returns its kind (see ConColumn)
+    // `level` is the one of the values
+    template<typename Cell>
+    uint8_t encodeColumn(size_t rows, Cell cell, uint64_t level, std::vector<uint8_t>& column);
+
+    // the kind, codec id, sizes and data of an encoded column, `compressed` is empty if it stays uncompressed
+    void writeColumn(uint8_t kind, const std::vector<uint8_t>& column, const std::vector<uint8_t>& compressed);
+
+    // compresses every input that the policy allows, on the pool if there is one
+    // an empty result means the input stays uncompressed
+    std::vector<std::vector<uint8_t>> compressAll(const ConValue& value, uint64_t level, const std::vector<std::pair<const uint8_t*, size_t>>& inputs) const {
+        std::vector<std::vector<uint8_t>> compressed(inputs.size());
+        auto compressOne = [&](size_t i) {
+            if (shouldCompress(value, level, inputs[i].first, inputs[i].second)) {
+                compressed[i] = compress(inputs[i].first, inputs[i].second);
+            }
+        };
+        if (pool && compressible(level) && inputs.size() > 1) {
+            std::vector<std::future<void>> done;
+            for (size_t i = 0; i < inputs.size(); i++) {
+                done.push_back(pool->submit([&compressOne, i] { compressOne(i); }));
+            }
+            for (std::future<void>& future : done) {
+                future.get();
+            }
+        } else {
+            for (size_t i = 0; i < inputs.size(); i++) {
+                compressOne(i);
+            }
+        }
+        return compressed;
+    }
+
+    // sets up the writer of a part that is encoded separately and appended to this one later
+    void prepare(ConWriter& part) const {
+        part.options = options;
+        part.format.version = format.version;
+        part.format.flags = format.flags;
+        part.codec = codec;
+        part.parent = parent ? parent : this;
+    }
+
+    // an object key, its index in compact documents with a key dictionary
+    void writeKey(std::string_view key) {
+        if (format.has(CON_FLAG_KEY_DICTIONARY)) {
+            writeSize(keyId(key));
+        } else {
+            writeSize(key.size());
+            write(key.data(), key.size());
+        }
+    }
+
+    // fills the key dictionary with the keys of every object in `value`, has to be called before writeHeader()
+    void collectKeys(const ConValue& value);
+
+    // finds the subtrees of `value` that occur more than once and encodes them for the shared table,
+    // has to be called after collectKeys() and before writeHeader()
+    void collectShared(ConValue& value);
+
+    // the index of the shared subtree `value` is written as, false if it is written as it is
+    bool sharedId(const ConValue& value, uint64_t& id) const {
+        const ConWriter* root = parent ? parent : this;
+        if (&value == defining || root->sharedIds.empty()) {
+            return false;
+        }
+        auto it = root->sharedIds.find(&value);
+        if (it == root->sharedIds.end()) {
+            return false;
+        }
+        id = it->second;
+        return true;
+    }
+
+    uint64_t keyId(std::string_view key) const {
+        return (parent ? parent : this)->keyIds.at(key);
+    }
+
+    // whether the `count` elements of a container at `depth` should be encoded on the pool
+    bool parallel(uint64_t depth, size_t count) const {
+        return pool && codec && depth + 1 <= options.maxDepth && count > 1;
+    }
+
+    // encodes `count` siblings on the pool and appends them in order, split into a few parts per thread
+    // encode(writer, i) writes sibling i into the writer of its part, placed(i, offset) is told where it ended up
+    template<typename Encode, typename Placed>
+    void writeParallel(size_t count, Encode encode, Placed placed) {
+        struct Part {
+            ConWriter writer;
+            std::vector<size_t> starts;
+        };
+        size_t partCount = std::min(count, pool->size() * 4);
+        std::vector<Part> parts(partCount);
+        std::vector<std::future<void>> done;
+        for (size_t part = 0; part < partCount; part++) {
+            size_t first = count * part / partCount;
+            size_t last = count * (part + 1) / partCount;
+            done.push_back(pool->submit([this, &parts, &encode, part, first, last] {
+                Part& current = parts[part];
+                prepare(current.writer);
+                for (size_t i = first; i < last; i++) {
+                    current.starts.push_back(current.writer.size());
+                    encode(current.writer, i);
+                }
+            }));
+        }
+        // parts are stitched together as soon as they're done, while the later ones are still being encoded
+        for (size_t part = 0; part < partCount; part++) {
+            done[part].get();
+            Part& current = parts[part];
+            size_t base = size();
+            size_t first = count * part / partCount;
+            for (size_t i = 0; i < current.starts.size(); i++) {
+                placed(first + i, base + current.starts[i]);
+            }
+            write(current.writer.data(), current.writer.size());
+            current = {};
+        }
+    }
+
+    // writes the document header, nothing for version 0
+    void writeHeader() {
+        if (format.version == 0) {
+            return;
+        }
+        write("CON", 3);
+        write(format.version);
+        write(format.flags);
+        if (format.has(CON_FLAG_DICTIONARY)) {
+            write(format.dictionary->id);
+        }
+        if (format.has(CON_FLAG_KEY_DICTIONARY)) {
+            writeSize(format.keys.size());
+            for (const std::string& key : format.keys) {
+                writeSize(key.size());
+                write(key.data(), key.size());
+            }
+        }
+        if (format.has(CON_FLAG_SHARED)) {
+            writeSize(sharedValues.size());
+            for (const std::vector<uint8_t>& value : sharedValues) {
+                writeSize(value.size());
+                write(value.data(), value.size());
+            }
+        }
+    }
+
+    size_t size() const {
+        return buffer.size();
+    }
+
+    uint8_t* data(size_t offset=0) {
+        return buffer.data() + offset;
+    }
+
+    void put(uint8_t byte) {
+        buffer.push_back(byte);
+    }
+
+    void write(const void* data, size_t size) {
+        const uint8_t* bytes = (const uint8_t*)data;
+        buffer.insert(buffer.end(), bytes, bytes + size);
+    }
+
+    template<typename T>
+    void write(const T& value) {
+        write(&value, sizeof(T));
+    }
+
+    void writeVarint(uint64_t value) {
+        while (value >= 0x80) {
+            put((uint8_t)(value | 0x80));
+            value >>= 7;
+        }
+        put((uint8_t)value);
+    }
+
+    // sizes, counts and key lengths, varints in compact documents
+    void writeSize(uint64_t size) {
+        if (format.has(CON_FLAG_COMPACT)) {
+            writeVarint(size);
+        } else {
+            write(size);
+        }
+    }
+
+    // reserves space for a header and returns its offset
+    size_t reserve(size_t size) {
+        size_t offset = buffer.size();
+        buffer.resize(offset + size);
+        return offset;
+    }
+
+    template<typename T>
+    void patch(size_t offset, const T& value) {
+        memcpy(buffer.data() + offset, &value, sizeof(T));
+    }
+
+    // removes `count` bytes starting at `offset`, shifting everything after it back
+    void erase(size_t offset, size_t count) {
+        buffer.erase(buffer.begin() + offset, buffer.begin() + offset + count);
+    }
+
+    void truncate(size_t size) {
+        buffer.resize(size);
+    }
+
+    void flush(std::ostream& stream) {
+        stream.write((char*)buffer.data(), buffer.size());
+        buffer.clear();
+    }
+};
+
+enum class ConType : uint8_t {
+    Null,
+    Boolean,
+    Integer,
+    Float,
+    String,
+    Array,
+    Object
+    #define CON_TYPE_Null void
+    #define CON_TYPE_Boolean bool
+    #define CON_TYPE_Integer int64_t
+    #define CON_TYPE_Float double
+    #define CON_TYPE_String std::pmr::string
+    #define CON_TYPE_Array ConArray
+    #define CON_TYPE_Object ConObject
+};
+
+struct ConObject;
+struct ConArray;
+
+#define CON_CAST(value, type) (*((CON_TYPE_##type*)(value).data()))
+
+// decoding state, the stream being read and the format of the document it belongs to
+struct ConReader {
+    std::istream& stream;
+    const ConFormat& format;
+    // blocked arrays (see CON_BLOCKED) are decoded on it, nullptr decodes them on the calling thread
+    ConThreadPool* pool = nullptr;
+    // the decoded subtrees of the shared table (see CON_FLAG_SHARED), references are decoded again without them
+    const std::vector<ConValue>* shared = nullptr;
+    // references hold the shared subtree itself instead of a copy of it (see conShare)
+    bool share = false;
+    // references can only refer to the subtrees before this one, so the table can't refer to itself
+    uint64_t sharedLimit = UINT64_MAX;
+    // depth of the values being read, 0 is the top-level value
+    uint64_t depth = 0;
+    // see ConValue::read
+    ConStats* stats = nullptr;
+
+    // a reader for a part of the document that is read on its own
+    ConReader part(std::istream& stream, ConThreadPool* pool=nullptr) const {
+        return ConReader{stream, format, pool, shared, share, sharedLimit, depth, stats};
+    }
+
+    // the encoding of the shared subtree a reference (after its type byte) refers to, nullptr if it is invalid
+    // (a subtree is never just a reference itself, so references don't chain)
+    const uint8_t* readReference(uint64_t& index, size_t& size) {
+        const uint8_t* data;
+        if (!readSize(index) || index >= sharedLimit || !(data = format.sharedValue(index, size)) || size == 0 || *data == CON_TAG_REFERENCE) {
+            ConLog() << "Invalid reference";
+            stream.setstate(std::ios::failbit);
+            return nullptr;
+        }
+        return data;
+    }
+
+    bool readVarint(uint64_t& value) {
+        return conReadVarint(stream, value);
+    }
+
+    // see ConWriter::writeSize
+    bool readSize(uint64_t& size) {
+        if (format.has(CON_FLAG_COMPACT)) {
+            return readVarint(size);
+        }
+        stream.read((char*)&size, sizeof(uint64_t));
+        return (bool)stream;
+    }
+};
+
+// the value type a type byte stands for
+ConType conTagType(uint8_t tag) {
+    if (tag >= CON_TAG_SMALL_INTEGER) {
+        return ConType::Integer;
+    } else if (tag == CON_TAG_FALSE || tag == CON_TAG_TRUE) {
+        return ConType::Boolean;
+    }
+    return (ConType)tag;
+}
+
+// tagged union, scalars and strings are stored inline
+// arrays and objects are owned through a pointer since they contain ConValues themselves
+// strings, arrays and objects allocate from a std::pmr::memory_resource (see ConArena), each of them
+// remembers its own resource, so values from different resources can be mixed and moved freely
+struct ConValue {
+    ConType type;
+    union {
+        bool boolean;
+        int64_t integer;
+        double floating;
+        std::pmr::string string;
+        ConArray* array;
+        ConObject* object;
+    };
+
+    ConValue() : type(ConType::Null), integer(0) {}
+    ConValue(bool value) : type(ConType::Boolean), boolean(value) {}
+    ConValue(int64_t value) : type(ConType::Integer), integer(value) {}
+    ConValue(double value) : type(ConType::Float), floating(value) {}
+    ConValue(std::pmr::string value) : type(ConType::String), string(std::move(value)) {}
+    ConValue(const std::string& value) : type(ConType::String), string(value.data(), value.size()) {}
+    ConValue(const char* value) : type(ConType::String), string(value) {}
+    // copies the array/object
+    ConValue(ConArray* value);
+    ConValue(ConObject* value);
+    // takes over the array/object
+    ConValue(ConArray&& value);
+    ConValue(ConObject&& value);
+
+    ConValue(const ConValue& other);
+    // deep copy that allocates from `resource`
+    ConValue(const ConValue& other, std::pmr::memory_resource* resource);
+    ConValue(ConValue&& other) noexcept;
+    ConValue& operator=(const ConValue& other);
+    ConValue& operator=(ConValue&& other) noexcept;
+    ~ConValue();
+
+    // destroys the held value, leaving Null
+    void reset();
+
+    // pointer to the held value, see CON_CAST
+    void* data() {
+        switch (type) {
+            case ConType::Boolean: return &boolean;
+            case ConType::Integer: return &integer;
+            case ConType::Float: return &floating;
+            case ConType::String: return &string;
+            case ConType::Array: return array;
+            case ConType::Object: return object;
+            default: return nullptr;
+        }
+    }
+
+    // lookups that never change anything, unlike the operator[] of ConObject (which inserts missing keys),
+    // so any number of threads can use them at the same time while nobody changes the value (see ConFrozen)
+    // the entry with `key`, nullptr if there is none or this isn't an object
+    const ConValue* find(std::string_view key) const;
+    // the entry with `key` / the element at `index`, a null value if there is none, so lookups can be chained
+    const ConValue& at(std::string_view key) const;
+    const ConValue& at(size_t index) const;
+
+    // writes a document in the original format (version 0)
+    void write(std::ostream& stream, uint64_t level=0);
+    // writes a document, including its header
+    void write(std::ostream& stream, const ConWriteOptions& options);
+    void write(ConWriter& writer, uint64_t level=0);
+
+    // reads a document in any version, everything decoded is allocated from `resource`
+    // the blocks of blocked arrays (see CON_BLOCKED) are decoded on `threads` threads (0 uses every core),
+    // with more than one `resource` has to be thread safe (the default one is, a ConArena isn't)
+    // with `share` every reference to a shared subtree (see CON_FLAG_SHARED) holds the same array/object
+    // instead of a copy of it (see conShare), copy it before changing it if the others shouldn't change too
+    // `stats` collects numbers about the read if set (see ConStats)
+    void read(std::istream& stream, std::pmr::memory_resource* resource=std::pmr::get_default_resource(), unsigned threads=1, bool share=false, ConStats* stats=nullptr);
+    void read(ConReader& reader, std::pmr::memory_resource* resource);
+};
+
+// kind of a column whose values are stored encoded one after the other, because they are arrays/objects
+// or don't all have the same type (the other kinds are ConType values)
+const static uint8_t CON_COLUMN_VALUES = 0xff;
+// kind of an integer column that stores the differences between its values (see ConWriteOptions::delta),
+// it is expanded to an Integer column before it is used
+const static uint8_t CON_COLUMN_DELTA = 0xfe;
+
+// expands the data of a CON_COLUMN_DELTA column into the data of an Integer column, false if it is invalid
+bool conExpandDelta(const uint8_t* data, size_t size, uint64_t rows, std::vector<uint8_t>& expanded) {
+    const uint8_t* p = data;
+    const uint8_t* end = data + size;
+    expanded.clear();
+    if (p >= end) {
+        return false;
+    }
+    bool hasNulls = *p;
+    size_t header = 1 + (hasNulls ? (rows + 7) / 8 : 0);
+    // every value takes at least one byte, that bounds the row count before anything is allocated
+    if (header > size || rows > size - header + (hasNulls ? rows : 0)) {
+        return false;
+    }
+    expanded.resize(header + rows * sizeof(int64_t));
+    memcpy(expanded.data(), data, header);
+    const uint8_t* nulls = hasNulls ? data + 1 : nullptr;
+    p += header;
+    int64_t previous = 0;
+    for (uint64_t i = 0; i < rows; i++) {
+        int64_t value = 0;
+        if (!nulls || !(nulls[i / 8] >> (i % 8) & 1)) {
+            uint64_t delta;
+            if (!conReadVarint(p, end, delta)) {
+                return false;
+            }
+            value = (int64_t)((uint64_t)previous + (uint64_t)conUnzigzag(delta));
+            previous = value;
+        }
+        memcpy(expanded.data() + header + i * sizeof(int64_t), &value, sizeof(int64_t));
+    }
+    return p == end;
+}
+
+// one decompressed column of a columnar or packed array (see CON_COLUMNAR), used in place
+// the data of a column depends on its kind, a typed column starts with a byte that says whether it has nulls,
+// followed by a bitmap of them (a set bit is a null, the value stored for them is 0/empty), then
+//   Integer: an int64 for every row
+//   Float: a double for every row
+//   Boolean: a bitmap
+//   String: the end offset (uint64) of every string, then the strings back to back
+//   Null: nothing, every value is null
+//   CON_COLUMN_VALUES: the offset (uint64) of every value, then the encoded values (anything can be null here)
+//   CON_COLUMN_DELTA: for every value that isn't null, the zigzag varint difference to the one before it (starting at 0)
+// other numbers are fixed width (even in compact documents), so a column can be scanned without decoding every value
+struct ConColumn {
+    uint8_t kind = (uint8_t)ConType::Null;
+    uint64_t rows = 0;
+    const uint8_t* nulls = nullptr;
+    const uint8_t* data = nullptr;
+    // offsets of String and CON_COLUMN_VALUES columns, data points at the first string/value then
+    const uint8_t* offsets = nullptr;
+    const uint8_t* end = nullptr;
+
+    bool read(uint8_t kind, const uint8_t* begin, size_t size, uint64_t rows) {
+        *this = {};
+        this->kind = kind;
+        this->rows = rows;
+        const uint8_t* p = begin;
+        end = begin + size;
+        if (kind == (uint8_t)ConType::Null) {
+            return size == 0;
+        }
+        if (kind != CON_COLUMN_VALUES) {
+            if (p >= end) {
+                return false;
+            }
+            bool hasNulls = *p++;
+            if (hasNulls) {
+                if ((rows + 7) / 8 > (uint64_t)(end - p)) {
+                    return false;
+                }
+                nulls = p;
+                p += (rows + 7) / 8;
+            }
+        }
+        uint64_t available = end - p;
+        switch (kind) {
+            case (uint8_t)ConType::Integer:
+            case (uint8_t)ConType::Float:
+                data = p;
+                return rows <= available / sizeof(uint64_t);
+            case (uint8_t)ConType::Boolean:
+                data = p;
+                return (rows + 7) / 8 <= available;
+            case (uint8_t)ConType::String:
+            case CON_COLUMN_VALUES:
+                if (rows > available / sizeof(uint64_t)) {
+                    return false;
+                }
+                offsets = p;
+                data = p + rows * sizeof(uint64_t);
+                return true;
+            case CON_COLUMN_DELTA:
+                ConLog() << "Delta columns have to be expanded before they are read";
+                return false;
+            default:
+                ConLog() << "Invalid column kind: " << (int)kind;
+                return false;
+        }
+    }
+
+    bool isNull(size_t row) const {
+        return kind == (uint8_t)ConType::Null || (nulls && (nulls[row / 8] >> (row % 8) & 1));
+    }
+
+    int64_t integer(size_t row) const {
+        int64_t value;
+        memcpy(&value, data + row * sizeof(int64_t), sizeof(int64_t));
+        return value;
+    }
+
+    double floating(size_t row) const {
+        double value;
+        memcpy(&value, data + row * sizeof(double), sizeof(double));
+        return value;
+    }
+
+    bool boolean(size_t row) const {
+        return data[row / 8] >> (row % 8) & 1;
+    }
+
+    std::string_view string(size_t row) const {
+        uint64_t from = row ? offset(row - 1) : 0;
+        uint64_t to = offset(row);
+        if (from > to || to > (uint64_t)(end - data)) {
+            return {};
+        }
+        return std::string_view((const char*)data + from, to - from);
+    }
+
+    // the encoded value of a CON_COLUMN_VALUES column, nullptr if the offset is out of range
+    const uint8_t* value(size_t row) const {
+        uint64_t from = offset(row);
+        return from < (uint64_t)(end - data) ? data + from : nullptr;
+    }
+
+    // the value of a typed column
+    ConValue cell(size_t row, std::pmr::memory_resource* resource) const {
+        if (isNull(row)) {
+            return ConValue();
+        }
+        switch (kind) {
+            case (uint8_t)ConType::Integer: return ConValue(integer(row));
+            case (uint8_t)ConType::Float: return ConValue(floating(row));
+            case (uint8_t)ConType::Boolean: return ConValue(boolean(row));
+            case (uint8_t)ConType::String: return ConValue(std::pmr::string(string(row), resource));
+            default: return ConValue();
+        }
+    }
+
+private:
+    uint64_t offset(size_t row) const {
+        uint64_t value;
+        memcpy(&value, offsets + row * sizeof(uint64_t), sizeof(uint64_t));
+        return value;
+    }
+};
+
+// the fields and columns of a columnar array, read from its payload (after the byte size)
+struct ConColumnLayout {
+    struct Column {
+        uint8_t kind;
+        // codec id, 0 if the column isn't compressed
+        uint8_t codec;
+        const uint8_t* data;
+        uint64_t size;
+        uint64_t rawSize;
+        // see ConFormat::dictionary
+        const ConDictionary* dictionary;
+
+        // decompresses and expands the column if it has to be, into `storage`
+        bool load(uint64_t rows, std::vector<uint8_t>& storage, ConColumn& column) const {
+            const uint8_t* begin = data;
+            size_t length = size;
+            if (codec) {
+                storage = conDecompress(codec, data, size, rawSize, dictionary);
+                if (storage.empty() && rawSize != 0) {
+                    return false;
+                }
+                begin = storage.data();
+                length = storage.size();
+            }
+            if (kind == CON_COLUMN_DELTA) {
+                std::vector<uint8_t> expanded;
+                if (!conExpandDelta(begin, length, rows, expanded)) {
+                    return false;
+                }
+                storage = std::move(expanded);
+                return column.read((uint8_t)ConType::Integer, storage.data(), storage.size(), rows);
+            }
+            return column.read(kind, begin, length, rows);
+        }
+    };
+
+    // the kind, codec id, sizes and data of one column
+    static bool readColumn(const ConFormat& format, const uint8_t*& p, const uint8_t* end, Column& column) {
+        column.rawSize = 0;
+        column.dictionary = format.dictionary.get();
+        if ((size_t)(end - p) < 2) {
+            return false;
+        }
+        column.kind = *p++;
+        column.codec = *p++;
+        if (!format.readSize(p, end, column.size) || (column.codec && !format.readSize(p, end, column.rawSize)) || column.size > (uint64_t)(end - p)) {
+            return false;
+        }
+        column.data = p;
+        p += column.size;
+        return true;
+    }
+
+    uint64_t rows = 0;
+    // point into the payload, or into the key dictionary of the format
+    std::vector<std::string_view> keys;
+    std::vector<Column> columns;
+
+    bool read(const ConFormat& format, const uint8_t* p, const uint8_t* end) {
+        uint64_t fields;
+        if (!format.readSize(p, end, rows) || !format.readSize(p, end, fields) || fields > (uint64_t)(end - p)) {
+            return false;
+        }
+        keys.clear();
+        columns.clear();
+        for (uint64_t i = 0; i < fields; i++) {
+            uint64_t keySize;
+            if (!format.readSize(p, end, keySize)) {
+                return false;
+            }
+            if (format.has(CON_FLAG_KEY_DICTIONARY)) {
+                // keySize is the index of the key
+                if (keySize >= format.keys.size()) {
+                    return false;
+                }
+                keys.push_back(format.keys[keySize]);
+            } else {
+                if (keySize > (uint64_t)(end - p)) {
+                    return false;
+                }
+                keys.emplace_back((const char*)p, keySize);
+                p += keySize;
+            }
+        }
+        for (uint64_t i = 0; i < fields; i++) {
+            Column column;
+            if (!readColumn(format, p, end, column)) {
+                return false;
+            }
+            columns.push_back(column);
+        }
+        return true;
+    }
+
+    // index of the field with `key`, or the field count
+    size_t find(std::string_view key) const {
+        return std::find(keys.begin(), keys.end(), key) - keys.begin();
+    }
+};
+
+// how many values hold an array/object, more than one only for nodes shared with conShare
+struct ConOwners {
+    std::atomic<uint32_t> count = 1;
+
+    ConOwners() = default;
+    // a copy of a node has its own owners
+    ConOwners(const ConOwners&) {}
+    ConOwners& operator=(const ConOwners&) {
+        return *this;
+    }
+
+    void acquire() {
+        count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // whether the last owner let go
+    bool release() {
+        return count.load(std::memory_order_acquire) == 1 || count.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+};
+
+// counts read from a document aren't trusted with an allocation before the values are there,
+// at most this many elements are reserved for them up front and the rest grow as they are read
+const static uint64_t CON_RESERVE_LIMIT = 64 * 1024;
+
+struct ConArray {
+    std::pmr::vector<ConValue> values;
+    ConOwners owners;
+
+    ConArray(std::pmr::memory_resource* resource=std::pmr::get_default_resource()) : values(resource) {}
+    ConArray(const ConArray& other) = default;
+    ConArray(ConArray&& other) = default;
+    ConArray(const ConArray& other, std::pmr::memory_resource* resource) : values(resource) {
+        values.reserve(other.values.size());
+        for (const ConValue& value : other.values) {
+            values.emplace_back(value, resource);
+        }
+    }
+    ConArray& operator=(const ConArray& other) = default;
+    ConArray& operator=(ConArray&& other) = default;
+
+    std::pmr::memory_resource* resource() const {
+        return values.get_allocator().resource();
+    }
+
+    ConValue& operator[](size_t index) {
+        return values[index];
+    }
+
+    // `starts` is filled with the offset of every element in the writer if it isn't nullptr
+    void write(ConWriter& writer, uint64_t level, std::vector<size_t>* starts=nullptr) {
+        uint64_t size = values.size();
+        writer.writeSize(size);
+        bool offsets = writer.format.has(CON_FLAG_OFFSETS);
+        size_t table = offsets ? writer.reserve(size * sizeof(uint64_t)) : 0;
+        size_t start = writer.size();
+        if (starts) {
+            starts->resize(size);
+        }
+        auto placed = [&](size_t i, size_t offset) {
+            if (offsets) {
+                writer.patch(table + i * sizeof(uint64_t), (uint64_t)(offset - start));
+            }
+            if (starts) {
+                (*starts)[i] = offset;
+            }
+        };
+        if (writer.parallel(level, size)) {
+            writer.writeParallel(size, [&](ConWriter& part, size_t i) { values[i].write(part, level+1); }, placed);
+            return;
+        }
+        for (size_t i = 0; i < size; i++) {
+            placed(i, writer.size());
+            values[i].write(writer, level+1);
+        }
+    }
+
+    void read(ConReader& reader) {
+        uint64_t size;
+        if (!reader.readSize(size)) {
+            return;
+        }
+        if (reader.format.has(CON_FLAG_OFFSETS)) {
+            // the offsets are only needed for random access
+            reader.stream.ignore(size * sizeof(uint64_t));
+        }
+        values.reserve(values.size() + std::min(size, CON_RESERVE_LIMIT));
+        for (size_t i = 0; i < size && reader.stream; i++) {
+            values.emplace_back().read(reader, resource());
+        }
+    }
+
+    // the payload of a blocked array (see CON_BLOCKED), after its codec byte
+    void readBlocks(ConReader& reader) {
+        const ConFormat& format = reader.format;
+        uint64_t size;
+        if (!reader.stream.read((char*)&size, sizeof(uint64_t))) {
+            return;
+        }
+        // read as a whole, the blocks are decoded straight out of it
+        std::vector<uint8_t> data;
+        if (!conReadBytes(reader.stream, data, size)) {
+            return;
+        }
+        const uint8_t* p = data.data();
+        const uint8_t* end = p + size;
+        uint64_t count;
+        uint64_t blockCount;
+        const size_t entrySize = 2 * sizeof(uint64_t);
+        if (!format.readSize(p, end, count) || !format.readSize(p, end, blockCount) || blockCount > (uint64_t)(end - p) / entrySize
+            || (blockCount == 0 && count != 0)) {
+            reader.stream.setstate(std::ios::failbit);
+            return;
+        }
+        const uint8_t* index = p;
+        const uint8_t* blocks = p + blockCount * entrySize;
+        auto entry = [&](size_t k, size_t field) {
+            uint64_t value;
+            memcpy(&value, index + k * entrySize + field * sizeof(uint64_t), sizeof(uint64_t));
+            return value;
+        };
+        auto blockEnd = [&](size_t k) {
+            return k + 1 < blockCount ? entry(k + 1, 1) : count;
+        };
+        // the element count is only trusted once every block has room for its elements
+        struct Block {
+            uint8_t compressed;
+            const uint8_t* data;
+            uint64_t stored;
+            uint64_t rawSize = 0;
+        };
+        std::vector<Block> headers(blockCount);
+        for (size_t k = 0; k < blockCount; k++) {
+            Block& header = headers[k];
+            bool valid = entry(k, 0) < (uint64_t)(end - blocks) && entry(k, 1) <= blockEnd(k) && (k != 0 || entry(k, 1) == 0);
+            if (valid) {
+                header.data = blocks + entry(k, 0);
+                header.compressed = *header.data++;
+                const ConCodec* codec = conCodec((ConCodecId)header.compressed);
+                valid = format.readSize(header.data, end, header.stored) && (!header.compressed || format.readSize(header.data, end, header.rawSize))
+                    && header.stored <= (uint64_t)(end - header.data) && (!header.compressed || (codec && conRawSizeFits(codec, header.stored, header.rawSize)))
+                    // every element takes at least a byte
+                    && blockEnd(k) - entry(k, 1) <= (header.compressed ? header.rawSize : header.stored);
+            }
+            if (!valid) {
+                ConLog() << "Invalid block index";
+                reader.stream.setstate(std::ios::failbit);
+                return;
+            }
+        }
+        size_t base = values.size();
+        values.resize(base + count);
+
+        auto decode = [&](size_t k) {
+            const uint8_t* block = headers[k].data;
+            uint8_t compressed = headers[k].compressed;
+            uint64_t stored = headers[k].stored;
+            uint64_t rawSize = headers[k].rawSize;
+            std::vector<uint8_t> decompressed;
+            if (compressed) {
+                decompressed = conDecompress(compressed, block, stored, rawSize, format.dictionary.get(), reader.stats);
+                if (decompressed.empty() && rawSize != 0) {
+                    return false;
+                }
+                block = decompressed.data();
+                stored = decompressed.size();
+            }
+            ConMemoryBuffer buffer(block, stored);
+            std::istream stream(&buffer);
+            ConReader inner = reader.part(stream);
+            for (uint64_t i = entry(k, 1); i < blockEnd(k) && stream; i++) {
+                values[base + i].read(inner, resource());
+            }
+            return (bool)stream;
+        };
+        // every thread takes the next block that nobody has started yet, until all of them are taken
+        std::atomic<size_t> next = 0;
+        std::atomic<bool> failed = false;
+        auto work = [&] {
+            for (size_t k; (k = next++) < blockCount;) {
+                if (!decode(k)) {
+                    failed = true;
+                }
+            }
+        };
+        std::vector<std::future<void>> done;
+        if (reader.pool) {
+            for (size_t i = 1; i < std::min<size_t>(reader.pool->size() + 1, blockCount); i++) {
+                done.push_back(reader.pool->submit(work));
+            }
+        }
+        work();
+        for (std::future<void>& future : done) {
+            future.get();
+        }
+        if (failed) {
+            reader.stream.setstate(std::ios::failbit);
+        }
+    }
+
+    // the payload of a columnar array (see CON_COLUMNAR), after its codec byte
+    void readColumns(ConReader& reader);
+
+    // the payload of a packed array (see CON_PACKED), after its codec byte
+    void readPacked(ConReader& reader) {
+        uint64_t size;
+        if (!reader.stream.read((char*)&size, sizeof(uint64_t))) {
+            return;
+        }
+        std::vector<uint8_t> data;
+        if (!conReadBytes(reader.stream, data, size)) {
+            return;
+        }
+        const uint8_t* p = data.data();
+        const uint8_t* end = p + size;
+        uint64_t count;
+        ConColumnLayout::Column stored;
+        std::vector<uint8_t> storage;
+        ConColumn column;
+        if (!reader.format.readSize(p, end, count) || !ConColumnLayout::readColumn(reader.format, p, end, stored) || !stored.load(count, storage, column) || column.kind == (uint8_t)ConType::Null || column.kind == (uint8_t)ConType::String || column.kind == CON_COLUMN_VALUES) {
+            ConLog() << "Invalid packed array";
+            reader.stream.setstate(std::ios::failbit);
+            return;
+        }
+        size_t base = values.size();
+        values.resize(base + count);
+        // one loop per kind, so the one for the numbers is a plain copy
+        switch (column.kind) {
+            case (uint8_t)ConType::Integer:
+                for (uint64_t i = 0; i < count; i++) {
+                    values[base + i] = ConValue(column.integer(i));
+                }
+                break;
+            case (uint8_t)ConType::Float:
+                for (uint64_t i = 0; i < count; i++) {
+                    values[base + i] = ConValue(column.floating(i));
+                }
+                break;
+            case (uint8_t)ConType::Boolean:
+                for (uint64_t i = 0; i < count; i++) {
+                    values[base + i] = ConValue(column.boolean(i));
+                }
+                break;
+            default:
+                break;
+        }
+        if (column.nulls) {
+            for (uint64_t i = 0; i < count; i++) {
+                if (column.isNull(i)) {
+                    values[base + i] = ConValue();
+                }
+            }
+        }
+    }
+};
+
+// the entries of an object, sorted by key in one contiguous buffer (a flat map)
+// lookups are binary searches and iteration walks memory in order, without a node per entry
+// has the parts of the std::map interface the library uses, but inserting moves the entries after the new one,
+// so unlike std::map references to entries are invalidated by inserts (appending in key order is cheap)
+// keys must not be changed in place, that would break the order
+struct ConEntries {
+    using value_type = std::pair<std::pmr::string, ConValue>;
+    using allocator_type = std::pmr::polymorphic_allocator<value_type>;
+    using iterator = std::pmr::vector<value_type>::iterator;
+    using const_iterator = std::pmr::vector<value_type>::const_iterator;
+
+    // keys are allocated from the vector's resource too (through uses-allocator construction)
+    std::pmr::vector<value_type> entries;
+
+    ConEntries(std::pmr::memory_resource* resource=std::pmr::get_default_resource()) : entries(resource) {}
+
+    allocator_type get_allocator() const {
+        return entries.get_allocator();
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+
+    bool empty() const {
+        return entries.empty();
+    }
+
+    void reserve(size_t size) {
+        entries.reserve(size);
+    }
+
+    void clear() {
+        entries.clear();
+    }
+
+    iterator begin() {
+        return entries.begin();
+    }
+
+    iterator end() {
+        return entries.end();
+    }
+
+    const_iterator begin() const {
+        return entries.begin();
+    }
+
+    const_iterator end() const {
+        return entries.end();
+    }
+
+    // first entry whose key isn't less than `key`
+    iterator lower_bound(std::string_view key) {
+        return std::lower_bound(entries.begin(), entries.end(), key, [](const value_type& entry, std::string_view key) {
+            return std::string_view(entry.first) < key;
+        });
+    }
+
+    const_iterator lower_bound(std::string_view key) const {
+        return const_cast<ConEntries*>(this)->lower_bound(key);
+    }
+
+    iterator find(std::string_view key) {
+        iterator it = lower_bound(key);
+        return it != end() && it->first == key ? it : end();
+    }
+
+    const_iterator find(std::string_view key) const {
+        return const_cast<ConEntries*>(this)->find(key);
+    }
+
+    bool contains(std::string_view key) const {
+        return find(key) != end();
+    }
+
+    size_t count(std::string_view key) const {
+        return contains(key) ? 1 : 0;
+    }
+
+    // the entry for `key`, constructed from `args` if there is none yet
+    // a hint of end() appends right away if the key comes after every other one
+    template<typename Key, typename... Args>
+    iterator try_emplace(const_iterator hint, Key&& key, Args&&... args) {
+        iterator it;
+        if (hint == end() && (empty() || std::string_view(entries.back().first) < std::string_view(key))) {
+            it = end();
+        } else {
+            it = lower_bound(key);
+            if (it != end() && it->first == std::string_view(key)) {
+                return it;
+            }
+        }
+        return entries.emplace(it, std::piecewise_construct, std::forward_as_tuple(std::forward<Key>(key)), std::forward_as_tuple(std::forward<Args>(args)...));
+    }
+
+    template<typename Key, typename... Args>
+        requires std::is_convertible_v<const Key&, std::string_view>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args) {
+        size_t count = size();
+        iterator it = try_emplace(end(), std::forward<Key>(key), std::forward<Args>(args)...);
+        return {it, size() != count};
+    }
+
+    iterator erase(const_iterator it) {
+        return entries.erase(it);
+    }
+
+    size_t erase(std::string_view key) {
+        iterator it = find(key);
+        if (it == end()) {
+            return 0;
+        }
+        entries.erase(it);
+        return 1;
+    }
+
+    // adds an entry at the end without looking for the key, for building objects whose keys come in any order
+    // sort() has to be called before the entries are used as a map again
+    template<typename Key>
+    ConValue& append(Key&& key) {
+        return entries.emplace_back(std::piecewise_construct, std::forward_as_tuple(std::forward<Key>(key)), std::forward_as_tuple()).second;
+    }
+
+    // puts appended entries back in order, of entries with the same key only the last one is kept
+    void sort() {
+        auto less = [](const value_type& a, const value_type& b) {
+            return std::string_view(a.first) < std::string_view(b.first);
+        };
+        if (std::adjacent_find(entries.begin(), entries.end(), [&](const value_type& a, const value_type& b) { return !less(a, b); }) == entries.end()) {
+            return;
+        }
+        // the indices are sorted instead of the entries, so every entry is only moved once
+        size_t size = entries.size();
+        std::array<uint32_t, 32> small;
+        std::vector<uint32_t> large;
+        uint32_t* order = size <= small.size() ? small.data() : (large.resize(size), large.data());
+        for (size_t i = 0; i < size; i++) {
+            order[i] = (uint32_t)i;
+        }
+        auto lessIndex = [&](uint32_t a, uint32_t b) {
+            return less(entries[a], entries[b]);
+        };
+        if (size <= small.size()) {
+            // insertion sort, std::stable_sort allocates a buffer even for a handful of entries
+            for (size_t i = 1; i < size; i++) {
+                std::rotate(std::upper_bound(order, order + i, order[i], lessIndex), order + i, order + i + 1);
+            }
+        } else {
+            std::stable_sort(order, order + size, lessIndex);
+        }
+        // order[i] is the entry that belongs at i, every cycle of the permutation is rotated through one temporary
+        for (size_t i = 0; i < size; i++) {
+            if (order[i] == i) {
+                continue;
+            }
+            value_type moved = std::move(entries[i]);
+            size_t j = i;
+            while (order[j] != i) {
+                size_t next = order[j];
+                entries[j] = std::move(entries[next]);
+                order[j] = (uint32_t)j;
+                j = next;
+            }
+            entries[j] = std::move(moved);
+            order[j] = (uint32_t)j;
+        }
+        iterator out = entries.begin();
+        for (iterator it = entries.begin(); it != entries.end(); ++it) {
+            if (it + 1 != entries.end() && it[1].first == it->first) {
+                continue;
+            }
+            if (out != it) {
+                *out = std::move(*it);
+            }
+            ++out;
+        }
+        entries.erase(out, entries.end());
+    }
+};
+
+struct ConObject {
+    ConEntries values;
+    ConOwners owners;
+
+    ConObject(std::pmr::memory_resource* resource=std::pmr::get_default_resource()) : values(resource) {}
+    ConObject(const ConObject& other) = default;
+    ConObject(ConObject&& other) = default;
+    ConObject(const ConObject& other, std::pmr::memory_resource* resource) : values(resource) {
+        for (auto& [key, value] : other.values) {
+            values.try_emplace(values.end(), key, value, resource);
+        }
+    }
+    ConObject& operator=(const ConObject& other) = default;
+    ConObject& operator=(ConObject&& other) = default;
+
+    std::pmr::memory_resource* resource() const {
+        return values.get_allocator().resource();
+    }
+
+    // inserts a null value if there is no entry with `key`, see find for lookups that don't
+    ConValue& operator[](std::string_view key) {
+        return values.try_emplace(key).first->second;
+    }
+
+    // nullptr if there is no entry with `key`
+    const ConValue* find(std::string_view key) const {
+        auto it = values.find(key);
+        return it != values.end() ? &it->second : nullptr;
+    }
+
+    void write(ConWriter& writer, uint64_t level) {
+        uint64_t size = values.size();
+        writer.writeSize(size);
+        bool index = writer.format.has(CON_FLAG_KEY_INDEX);
+        bool offsets = index || writer.format.has(CON_FLAG_OFFSETS);
+        size_t entrySize = (index ? 2 : 1) * sizeof(uint64_t);
+        size_t table = offsets ? writer.reserve(size * entrySize) : 0;
+        size_t start = writer.size();
+        auto placed = [&](size_t i, const std::pmr::string& key, size_t offset) {
+            size_t entry = table + i * entrySize;
+            if (index) {
+                writer.patch(entry, conKeyPrefix(key));
+                entry += sizeof(uint64_t);
+            }
+            if (offsets) {
+                writer.patch(entry, (uint64_t)(offset - start));
+            }
+        };
+        auto encode = [&](ConWriter& writer, const std::pmr::string& key, ConValue& value) {
+            writer.writeKey(key);
+            value.write(writer, level+1);
+        };
+        if (writer.parallel(level, size)) {
+            std::vector<ConEntries::value_type*> entries;
+            entries.reserve(size);
+            for (auto& entry : values) {
+                entries.push_back(&entry);
+            }
+            writer.writeParallel(size,
+                [&](ConWriter& part, size_t i) { encode(part, entries[i]->first, entries[i]->second); },
+                [&](size_t i, size_t offset) { placed(i, entries[i]->first, offset); });
+            return;
+        }
+        size_t i = 0;
+        for (auto& [key, value] : values) {
+            placed(i++, key, writer.size());
+            encode(writer, key, value);
+        }
+    }
+    void read(ConReader& reader) {
+        std::istream& stream = reader.stream;
+        uint64_t size;
+        if (!reader.readSize(size)) {
+            return;
+        }
+        if (reader.format.has(CON_FLAG_KEY_INDEX)) {
+            stream.ignore(size * 2 * sizeof(uint64_t));
+        } else if (reader.format.has(CON_FLAG_OFFSETS)) {
+            stream.ignore(size * sizeof(uint64_t));
+        }
+        bool dictionary = reader.format.has(CON_FLAG_KEY_DICTIONARY);
+        values.reserve(values.size() + std::min(size, CON_RESERVE_LIMIT));
+        for (size_t i = 0; i < size && stream; i++) {
+            uint64_t keySize;
+            if (!reader.readSize(keySize)) {
+                return;
+            }
+            std::pmr::string key(resource());
+            if (dictionary) {
+                // keySize is the index of the key
+                if (keySize >= reader.format.keys.size()) {
+                    ConLog() << "Invalid key index: " << keySize;
+                    stream.setstate(std::ios::failbit);
+                    return;
+                }
+                key = reader.format.keys[keySize];
+            } else if (!conReadBytes(stream, key, keySize)) {
+                return;
+            }
+            // keys come out of the writer sorted, so the hint appends every entry
+            auto it = values.try_emplace(values.end(), std::move(key));
+            it->second.read(reader, resource());
+        }
+    }
+};
+
+
+// arrays and objects are allocated from the same resource as their contents, so they can be freed
+// without having to remember where they came from
+template<typename T>
+T* conNewNode(std::pmr::memory_resource* resource, T&& value) {
+    return std::pmr::polymorphic_allocator<T>(resource).template new_object<T>(std::forward<T>(value));
+}
+
+template<typename T>
+void conDeleteNode(T* node) {
+    std::pmr::polymorphic_allocator<T>(node->resource()).delete_object(node);
+}
+
+// what lookups return when there is nothing to return
+const ConValue& conNull() {
+    const static ConValue null;
+    return null;
+}
+
+const ConValue* ConValue::find(std::string_view key) const {
+    return type == ConType::Object ? object->find(key) : nullptr;
+}
+
+const ConValue& ConValue::at(std::string_view key) const {
+    const ConValue* value = find(key);
+    return value ? *value : conNull();
+}
+
+const ConValue& ConValue::at(size_t index) const {
+    return type == ConType::Array && index < array->values.size() ? array->values[index] : conNull();
+}
+
+ConValue::ConValue(ConArray* value) : ConValue(ConArray(*value)) {}
+ConValue::ConValue(ConObject* value) : ConValue(ConObject(*value)) {}
+ConValue::ConValue(ConArray&& value) : type(ConType::Array), array(conNewNode(value.resource(), std::move(value))) {}
+ConValue::ConValue(ConObject&& value) : type(ConType::Object), object(conNewNode(value.resource(), std::move(value))) {}
+
+ConValue::ConValue(const ConValue& other) : ConValue(other, std::pmr::get_default_resource()) {}
+
+ConValue::ConValue(const ConValue& other, std::pmr::memory_resource* resource) : type(other.type), integer(0) {
+    switch (type) {
+        case ConType::Boolean:
+            boolean = other.boolean;
+            break;
+        case ConType::Integer:
+            integer = other.integer;
+            break;
+        case ConType::Float:
+            floating = other.floating;
+            break;
+        case ConType::String:
+            new (&string) std::pmr::string(other.string, resource);
+            break;
+        case ConType::Array:
+            array = conNewNode(resource, ConArray(*other.array, resource));
+            break;
+        case ConType::Object:
+            object = conNewNode(resource, ConObject(*other.object, resource));
+            break;
+        default:
+            type = ConType::Null;
+            break;
+    }
+}
+
+ConValue::ConValue(ConValue&& other) noexcept : type(other.type), integer(0) {
+    switch (type) {
+        case ConType::Boolean:
+            boolean = other.boolean;
+            break;
+        case ConType::Integer:
+            integer = other.integer;
+            break;
+        case ConType::Float:
+            floating = other.floating;
+            break;
+        case ConType::String:
+            new (&string) std::pmr::string(std::move(other.string));
+            other.reset();
+            break;
+        case ConType::Array:
+            array = other.array;
+            other.type = ConType::Null;
+            break;
+        case ConType::Object:
+            object = other.object;
+            other.type = ConType::Null;
+            break;
+        default:
+            type = ConType::Null;
+            break;
+    }
+}
+
+ConValue& ConValue::operator=(const ConValue& other) {
+    if (this != &other) {
+        // copy first, other may live inside of this value
+        ConValue copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+ConValue& ConValue::operator=(ConValue&& other) noexcept {
+    if (this != &other) {
+        // other may live inside of this value (value = std::move(value["child"])), so take it over before destroying anything
+        ConValue moved(std::move(other));
+        reset();
+        new (this) ConValue(std::move(moved));
+    }
+    return *this;
+}
+
+ConValue::~ConValue() {
+    reset();
+}
+
+void ConValue::reset() {
+    switch (type) {
+        case ConType::String:
+            string.~basic_string();
+            break;
+        case ConType::Array:
+            if (array->owners.release()) {
+                conDeleteNode(array);
+            }
+            break;
+        case ConType::Object:
+            if (object->owners.release()) {
+                conDeleteNode(object);
+            }
+            break;
+        default:
+            break;
+    }
+    type = ConType::Null;
+    integer = 0;
+}
+
+// a value holding the same array/object as `value` instead of a copy of it (scalars and strings are copied),
+// changes made through one of them show up in the other, the node is freed with the last of them
+ConValue conShare(const ConValue& value, std::pmr::memory_resource* resource=std::pmr::get_default_resource()) {
+    if (value.type != ConType::Array && value.type != ConType::Object) {
+        return ConValue(value, resource);
+    }
+    ConValue shared;
+    shared.type = value.type;
+    if (value.type == ConType::Array) {
+        value.array->owners.acquire();
+        shared.array = value.array;
+    } else {
+        value.object->owners.acquire();
+        shared.object = value.object;
+    }
+    return shared;
+}
+
+void ConValue::write(std::ostream& stream, uint64_t level) {
+    ConWriter writer;
+    write(writer, level);
+    writer.flush(stream);
+}
+
+void ConWriter::collectKeys(const ConValue& value) {
+    std::vector<const ConValue*> stack = {&value};
+    std::vector<std::string_view> keys;
+    while (!stack.empty()) {
+        const ConValue* current = stack.back();
+        stack.pop_back();
+        if (current->type == ConType::Array) {
+            for (const ConValue& element : current->array->values) {
+                stack.push_back(&element);
+            }
+        } else if (current->type == ConType::Object) {
+            for (auto& [key, element] : current->object->values) {
+                if (keyIds.try_emplace(key, 0).second) {
+                    keys.push_back(key);
+                }
+                stack.push_back(&element);
+            }
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+    format.keys.assign(keys.begin(), keys.end());
+    // keyIds pointed into the tree until now, point them at the dictionary instead
+    keyIds.clear();
+    for (size_t i = 0; i < format.keys.size(); i++) {
+        keyIds[format.keys[i]] = i;
+    }
+}
+
+// whether two values are the same, floats are compared bit by bit
+bool conEqual(const ConValue& a, const ConValue& b) {
+    if (a.type != b.type) {
+        return false;
+    }
+    switch (a.type) {
+        case ConType::Boolean:
+            return a.boolean == b.boolean;
+        case ConType::Integer:
+            return a.integer == b.integer;
+        case ConType::Float:
+            return memcmp(&a.floating, &b.floating, sizeof(double)) == 0;
+        case ConType::String:
+            return a.string == b.string;
+        case ConType::Array: {
+            const std::pmr::vector<ConValue>& left = a.array->values;
+            const std::pmr::vector<ConValue>& right = b.array->values;
+            if (a.array == b.array) {
+                return true;
+            } else if (left.size() != right.size()) {
+                return false;
+            }
+            for (size_t i = 0; i < left.size(); i++) {
+                if (!conEqual(left[i], right[i])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case ConType::Object: {
+            const ConEntries& left = a.object->values;
+            const ConEntries& right = b.object->values;
+            if (a.object == b.object) {
+                return true;
+            } else if (left.size() != right.size()) {
+                return false;
+            }
+            for (auto i = left.begin(), j = right.begin(); i != left.end(); ++i, ++j) {
+                if (i->first != j->first || !conEqual(i->second, j->second)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        default:
+            return true;
+    }
+}
+
+void ConWriter::collectShared(ConValue& value) {
+    // every string/array/object, parents before their children
+    struct Node {
+        ConValue* value;
+        uint64_t level;
+        uint64_t hash = 0;
+        // the size of its encoding, estimated
+        uint64_t size = 0;
+        // the group of equal subtrees it belongs to, SIZE_MAX if it is too small to be shared
+        size_t group = SIZE_MAX;
+    };
+    auto container = [](const ConValue& value) {
+        return value.type == ConType::String || value.type == ConType::Array || value.type == ConType::Object;
+    };
+    std::vector<Node> nodes;
+    std::unordered_map<const ConValue*, size_t> indices;
+    std::vector<std::pair<ConValue*, uint64_t>> stack = {{&value, 0}};
+    while (!stack.empty()) {
+        auto [current, level] = stack.back();
+        stack.pop_back();
+        indices[current] = nodes.size();
+        nodes.push_back({current, level});
+        if (current->type == ConType::Array) {
+            for (ConValue& element : current->array->values) {
+                if (container(element)) {
+                    stack.emplace_back(&element, level + 1);
+                }
+            }
+        } else if (current->type == ConType::Object) {
+            for (auto& [key, element] : current->object->values) {
+                if (container(element)) {
+                    stack.emplace_back(&element, level + 1);
+                }
+            }
+        }
+    }
+    if (!container(value)) {
+        return;
+    }
+
+    // hashes and sizes, children before their parents
+    auto mix = [](uint64_t hash, uint64_t value) {
+        return hash ^ (value + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2));
+    };
+    auto add = [&](const ConValue& child, uint64_t& hash, uint64_t& size) {
+        if (container(child)) {
+            const Node& node = nodes[indices[&child]];
+            hash = mix(hash, node.hash);
+            size += node.size;
+            return;
+        }
+        uint64_t bits = 0;
+        if (child.type == ConType::Boolean) {
+            bits = child.boolean;
+        } else if (child.type == ConType::Integer) {
+            bits = child.integer;
+        } else if (child.type == ConType::Float) {
+            memcpy(&bits, &child.floating, sizeof(double));
+        }
+        hash = mix(mix(hash, (uint64_t)child.type), bits);
+        size += 1 + sizeof(uint64_t);
+    };
+    std::hash<std::string_view> hashString;
+    for (size_t i = nodes.size(); i-- > 0;) {
+        Node& node = nodes[i];
+        const ConValue& current = *node.value;
+        uint64_t hash = (uint64_t)current.type;
+        uint64_t size = 1 + 2 * sizeof(uint64_t);
+        if (current.type == ConType::String) {
+            hash = mix(hash, hashString(current.string));
+            size += current.string.size();
+        } else if (current.type == ConType::Array) {
+            for (const ConValue& element : current.array->values) {
+                add(element, hash, size);
+            }
+        } else {
+            for (auto& [key, element] : current.object->values) {
+                hash = mix(hash, hashString(key));
+                size += key.size() + sizeof(uint64_t);
+                add(element, hash, size);
+            }
+        }
+        node.hash = hash;
+        node.size = size;
+    }
+
+    // equal subtrees are put into groups, the hash only narrows down which ones have to be compared
+    struct Group {
+        uint64_t count = 0;
+        // occurrences that are written, the ones inside of a repeated subtree are only written once
+        uint64_t written = 0;
+        // the first of them, it is the one in the table
+        size_t first = SIZE_MAX;
+    };
+    std::vector<Group> groups;
+    std::unordered_map<uint64_t, std::vector<size_t>> byHash;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        Node& node = nodes[i];
+        if (node.size < options.sharedSize) {
+            continue;
+        }
+        std::vector<size_t>& candidates = byHash[node.hash];
+        for (size_t group : candidates) {
+            if (conEqual(*nodes[groups[group].first].value, *node.value)) {
+                node.group = group;
+                break;
+            }
+        }
+        if (node.group == SIZE_MAX) {
+            node.group = groups.size();
+            candidates.push_back(groups.size());
+            groups.emplace_back().first = i;
+        }
+        groups[node.group].count++;
+    }
+    std::vector<size_t> occurrences;
+    std::vector<size_t> pending = {0};
+    while (!pending.empty()) {
+        size_t i = pending.back();
+        pending.pop_back();
+        const Node& node = nodes[i];
+        if (node.group != SIZE_MAX && groups[node.group].count > 1) {
+            Group& group = groups[node.group];
+            occurrences.push_back(i);
+            if (group.written++ > 0) {
+                // it is a reference, nothing inside of it is written here
+                continue;
+            }
+            group.first = i;
+        }
+        const ConValue& current = *node.value;
+        if (current.type == ConType::Array) {
+            for (const ConValue& element : current.array->values) {
+                if (container(element)) {
+                    pending.push_back(indices[&element]);
+                }
+            }
+        } else if (current.type == ConType::Object) {
+            for (auto& [key, element] : current.object->values) {
+                if (container(element)) {
+                    pending.push_back(indices[&element]);
+                }
+            }
+        }
+    }
+
+    // a subtree inside of another one is smaller, so ordering them by size puts every subtree after the ones it refers to
+    std::vector<size_t> shared;
+    for (size_t group = 0; group < groups.size(); group++) {
+        if (groups[group].written > 1) {
+            shared.push_back(group);
+        }
+    }
+    std::sort(shared.begin(), shared.end(), [&](size_t a, size_t b) {
+        return std::make_pair(nodes[groups[a].first].size, a) < std::make_pair(nodes[groups[b].first].size, b);
+    });
+    std::vector<uint64_t> ids(groups.size(), UINT64_MAX);
+    for (size_t i = 0; i < shared.size(); i++) {
+        ids[shared[i]] = i;
+    }
+    for (size_t i : occurrences) {
+        if (ids[nodes[i].group] != UINT64_MAX) {
+            sharedIds[nodes[i].value] = ids[nodes[i].group];
+        }
+    }
+    for (size_t group : shared) {
+        const Node& node = nodes[groups[group].first];
+        ConWriter part;
+        prepare(part);
+        part.defining = node.value;
+        node.value->write(part, node.level);
+        sharedValues.push_back(std::move(part.buffer));
+    }
+}
+
+bool ConWriter::writeBlocks(const ConValue& value, uint64_t level, size_t header, const std::vector<size_t>& starts) {
+    // index of the first element of every block
+    std::vector<size_t> firsts = {0};
+    for (size_t i = 1; i < starts.size(); i++) {
+        size_t first = firsts.back();
+        if ((options.blockElements && i - first >= options.blockElements) || (options.blockBytes && starts[i] - starts[first] >= options.blockBytes)) {
+            firsts.push_back(i);
+        }
+    }
+    if (firsts.size() <= 1) {
+        return false;
+    }
+    size_t blockCount = firsts.size();
+    size_t base = starts[0];
+    std::vector<uint8_t> elements(data(base), data(size()));
+    auto blockRange = [&](size_t k) {
+        size_t from = starts[firsts[k]] - base;
+        size_t to = k + 1 < blockCount ? starts[firsts[k + 1]] - base : elements.size();
+        return std::pair(from, to);
+    };
+    std::vector<std::pair<const uint8_t*, size_t>> inputs;
+    for (size_t k = 0; k < blockCount; k++) {
+        auto [from, to] = blockRange(k);
+        inputs.emplace_back(elements.data() + from, to - from);
+    }
+    std::vector<std::vector<uint8_t>> compressed = compressAll(value, level, inputs);
+
+    truncate(header);
+    put(CON_BLOCKED);
+    size_t sizeAt = reserve(sizeof(uint64_t));
+    size_t payload = size();
+    writeSize(starts.size());
+    writeSize(blockCount);
+    size_t index = reserve(blockCount * 2 * sizeof(uint64_t));
+    size_t first = size();
+    for (size_t k = 0; k < blockCount; k++) {
+        auto [from, to] = blockRange(k);
+        patch(index + 2 * k * sizeof(uint64_t), (uint64_t)(size() - first));
+        patch(index + (2 * k + 1) * sizeof(uint64_t), (uint64_t)firsts[k]);
+        if (!compressed[k].empty()) {
+            put((uint8_t)codec->id);
+            writeSize(compressed[k].size());
+            writeSize(to - from);
+            write(compressed[k].data(), compressed[k].size());
+        } else {
+            put(0);
+            writeSize(to - from);
+            write(elements.data() + from, to - from);
+        }
+    }
+    patch(sizeAt, (uint64_t)(size() - payload));
+    return true;
+}
+
+void ConArray::readColumns(ConReader& reader) {
+    uint64_t size;
+    if (!reader.stream.read((char*)&size, sizeof(uint64_t))) {
+        return;
+    }
+    std::vector<uint8_t> data;
+    ConColumnLayout layout;
+    if (!conReadBytes(reader.stream, data, size)) {
+        return;
+    } else if (!layout.read(reader.format, data.data(), data.data() + size)) {
+        ConLog() << "Invalid columns";
+        reader.stream.setstate(std::ios::failbit);
+        return;
+    }
+    // the columns are loaded before the rows are made, loading checks the row count against their data
+    size_t fields = layout.columns.size();
+    std::vector<std::vector<uint8_t>> storage(fields);
+    std::vector<ConColumn> columns(fields);
+    for (size_t field = 0; field < fields; field++) {
+        if (!layout.columns[field].load(layout.rows, storage[field], columns[field])) {
+            ConLog() << "Invalid column";
+            reader.stream.setstate(std::ios::failbit);
+            return;
+        }
+    }
+    size_t base = values.size();
+    // columns of nulls have no data, so the count still isn't trusted with the whole reservation
+    values.reserve(base + std::min(layout.rows, CON_RESERVE_LIMIT));
+    for (uint64_t i = 0; i < layout.rows; i++) {
+        ConObject& row = *values.emplace_back(ConObject(resource())).object;
+        row.values.reserve(layout.keys.size());
+    }
+    // the fields are written in key order, so appending keeps every row sorted
+    for (size_t field = 0; field < fields; field++) {
+        const ConColumn& column = columns[field];
+        std::string_view key = layout.keys[field];
+        if (column.kind == CON_COLUMN_VALUES) {
+            // the values follow each other, so they're read in one go
+            ConMemoryBuffer buffer(column.data, column.end - column.data);
+            std::istream stream(&buffer);
+            ConReader inner = reader.part(stream);
+            for (uint64_t i = 0; i < layout.rows && stream; i++) {
+                values[base + i].object->values.append(key).read(inner, resource());
+            }
+            if (!stream) {
+                reader.stream.setstate(std::ios::failbit);
+                return;
+            }
+        } else {
+            for (uint64_t i = 0; i < layout.rows; i++) {
+                values[base + i].object->values.append(key) = column.cell(i, resource());
+            }
+        }
+    }
+    // only files that weren't written by this library can get here
+    if (!std::is_sorted(layout.keys.begin(), layout.keys.end()) || std::adjacent_find(layout.keys.begin(), layout.keys.end()) != layout.keys.end()) {
+        for (uint64_t i = 0; i < layout.rows; i++) {
+            values[base + i].object->values.sort();
+        }
+    }
+}
+
+bool ConWriter::columnar(const ConArray& array) const {
+    if (format.version < 1 || !options.columnar || array.values.size() < 2) {
+        return false;
+    }
+    const ConValue& first = array.values[0];
+    if (first.type != ConType::Object || first.object->values.empty()) {
+        return false;
+    }
+    const ConEntries& schema = first.object->values;
+    for (const ConValue& row : array.values) {
+        if (row.type != ConType::Object || row.object->values.size() != schema.size()) {
+            return false;
+        }
+        auto field = schema.begin();
+        for (auto& [key, value] : row.object->values) {
+            if (key != (field++)->first) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template<typename Cell>
+uint8_t ConWriter::encodeColumn(size_t rows, Cell cell, uint64_t level, std::vector<uint8_t>& column) {
+    auto bitmap = [&](auto&& bit) {
+        size_t start = column.size();
+        column.resize(start + (rows + 7) / 8);
+        for (size_t i = 0; i < rows; i++) {
+            if (bit(i)) {
+                column[start + i / 8] |= 1 << (i % 8);
+            }
+        }
+    };
+    // the type every value that isn't null has
+    ConType type = ConType::Null;
+    bool nulls = false;
+    bool mixed = false;
+    for (size_t i = 0; i < rows; i++) {
+        ConType current = cell(i).type;
+        if (current == ConType::Null) {
+            nulls = true;
+        } else if (type == ConType::Null) {
+            type = current;
+        } else if (current != type) {
+            mixed = true;
+        }
+    }
+    if (mixed || type == ConType::Array || type == ConType::Object) {
+        // the values are encoded like they would be in place
+        ConWriter part;
+        prepare(part);
+        size_t table = part.reserve(rows * sizeof(uint64_t));
+        size_t start = part.size();
+        for (size_t i = 0; i < rows; i++) {
+            part.patch(table + i * sizeof(uint64_t), (uint64_t)(part.size() - start));
+            cell(i).write(part, level);
+        }
+        column = std::move(part.buffer);
+        return CON_COLUMN_VALUES;
+    }
+    if (type == ConType::Null) {
+        return (uint8_t)type;
+    }
+    column.push_back(nulls);
+    if (nulls) {
+        bitmap([&](size_t i) { return cell(i).type == ConType::Null; });
+    }
+    switch (type) {
+        case ConType::Integer:
+            if (options.delta) {
+                int64_t previous = 0;
+                for (size_t i = 0; i < rows; i++) {
+                    if (cell(i).type == ConType::Integer) {
+                        // wraps around instead of overflowing
+                        uint64_t delta = conZigzag((int64_t)((uint64_t)cell(i).integer - (uint64_t)previous));
+                        while (delta >= 0x80) {
+                            column.push_back((uint8_t)(delta | 0x80));
+                            delta >>= 7;
+                        }
+                        column.push_back((uint8_t)delta);
+                        previous = cell(i).integer;
+                    }
+                }
+                return CON_COLUMN_DELTA;
+            }
+            [[fallthrough]];
+        case ConType::Float: {
+            size_t start = column.size();
+            column.resize(start + rows * sizeof(uint64_t));
+            for (size_t i = 0; i < rows; i++) {
+                uint8_t* target = column.data() + start + i * sizeof(uint64_t);
+                // nulls are stored as 0
+                if (cell(i).type == ConType::Integer) {
+                    memcpy(target, &cell(i).integer, sizeof(int64_t));
+                } else if (cell(i).type == ConType::Float) {
+                    memcpy(target, &cell(i).floating, sizeof(double));
+                }
+            }
+            break;
+        }
+        case ConType::Boolean:
+            bitmap([&](size_t i) { return cell(i).type == ConType::Boolean && cell(i).boolean; });
+            break;
+        case ConType::String: {
+            size_t table = column.size();
+            column.resize(table + rows * sizeof(uint64_t));
+            uint64_t offset = 0;
+            for (size_t i = 0; i < rows; i++) {
+                if (cell(i).type == ConType::String) {
+                    const std::pmr::string& string = cell(i).string;
+                    column.insert(column.end(), string.begin(), string.end());
+                    offset += string.size();
+                }
+                memcpy(column.data() + table + i * sizeof(uint64_t), &offset, sizeof(uint64_t));
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return (uint8_t)type;
+}
+
+void ConWriter::writeColumn(uint8_t kind, const std::vector<uint8_t>& column, const std::vector<uint8_t>& compressed) {
+    put(kind);
+    if (!compressed.empty()) {
+        put((uint8_t)codec->id);
+        writeSize(compressed.size());
+        writeSize(column.size());
+        write(compressed.data(), compressed.size());
+    } else {
+        put(0);
+        writeSize(column.size());
+        write(column.data(), column.size());
+    }
+}
+
+void ConWriter::writeColumns(ConValue& value, uint64_t level) {
+    std::pmr::vector<ConValue>& rows = value.array->values;
+    const ConEntries& schema = rows[0].object->values;
+    size_t fields = schema.size();
+    put(CON_COLUMNAR);
+    size_t sizeAt = reserve(sizeof(uint64_t));
+    size_t payload = size();
+    writeSize(rows.size());
+    writeSize(fields);
+    for (auto& [key, unused] : schema) {
+        writeKey(key);
+    }
+    std::vector<uint8_t> kinds(fields);
+    std::vector<std::vector<uint8_t>> columns(fields);
+    std::vector<std::pair<const uint8_t*, size_t>> inputs;
+    for (size_t field = 0; field < fields; field++) {
+        // values inside of the rows are two levels down
+        kinds[field] = encodeColumn(rows.size(), [&](size_t i) -> ConValue& { return rows[i].object->values.entries[field].second; }, level + 2, columns[field]);
+        inputs.emplace_back(columns[field].data(), columns[field].size());
+    }
+    std::vector<std::vector<uint8_t>> compressed = compressAll(value, level, inputs);
+    for (size_t field = 0; field < fields; field++) {
+        writeColumn(kinds[field], columns[field], compressed[field]);
+    }
+    patch(sizeAt, (uint64_t)(size() - payload));
+}
+
+bool ConWriter::packable(const ConArray& array) const {
+    if (format.version < 1 || !options.packed || array.values.size() < 2) {
+        return false;
+    }
+    ConType type = ConType::Null;
+    for (const ConValue& element : array.values) {
+        if (element.type == ConType::Null) {
+            continue;
+        } else if (element.type != ConType::Integer && element.type != ConType::Float && element.type != ConType::Boolean) {
+            return false;
+        } else if (type != ConType::Null && element.type != type) {
+            return false;
+        }
+        type = element.type;
+    }
+    return type != ConType::Null;
+}
+
+void ConWriter::writePacked(ConValue& value, uint64_t level) {
+    std::pmr::vector<ConValue>& values = value.array->values;
+    put(CON_PACKED);
+    size_t sizeAt = reserve(sizeof(uint64_t));
+    size_t payload = size();
+    writeSize(values.size());
+    std::vector<uint8_t> column;
+    uint8_t kind = encodeColumn(values.size(), [&](size_t i) -> ConValue& { return values[i]; }, level + 1, column);
+    std::vector<std::vector<uint8_t>> compressed = compressAll(value, level, {{column.data(), column.size()}});
+    writeColumn(kind, column, compressed[0]);
+    patch(sizeAt, (uint64_t)(size() - payload));
+}
+
+void ConValue::write(std::ostream& stream, const ConWriteOptions& options) {
+    auto start = std::chrono::steady_clock::now();
+    ConWriter writer(options);
+    if (writer.format.has(CON_FLAG_KEY_DICTIONARY)) {
+        writer.collectKeys(*this);
+    }
+    if (writer.format.has(CON_FLAG_SHARED)) {
+        writer.collectShared(*this);
+    }
+    writer.writeHeader();
+    write(writer, 0);
+    uint64_t size = writer.size();
+    writer.flush(stream);
+    if (options.stats) {
+        options.stats->document(start, size);
+        options.stats->resolve(*this);
+    }
+}
+
+// trains a dictionary on documents like the ones that will be written with `options` (for its codec),
+// using their encoding without compression, register it and set it in ConWriteOptions::dictionary to use it
+std::vector<uint8_t> conTrainDictionary(std::vector<ConValue>& samples, const ConWriteOptions& options, size_t size=CON_DICTIONARY_SIZE) {
+    ConWriteOptions plain = options;
+    plain.codec = ConCodecId::None;
+    plain.dictionary = nullptr;
+    plain.stats = nullptr;
+    std::vector<std::string> encoded;
+    encoded.reserve(samples.size());
+    for (ConValue& sample : samples) {
+        std::ostringstream stream;
+        sample.write(stream, plain);
+        encoded.push_back(std::move(stream).str());
+    }
+    return conTrainDictionary(std::vector<std::string_view>(encoded.begin(), encoded.end()), options.codec, size);
+}
+
+void ConStats::resolve(const ConValue& root) {
+    std::lock_guard lock(mutex);
+    size_t missing = 0;
+    for (const Subtree& subtree : largest) {
+        // the top-level value's path stays empty
+        missing += subtree.path.empty() && subtree.value != &root;
+    }
+    std::string path;
+    auto walk = [&](auto& walk, const ConValue& value) -> void {
+        for (Subtree& subtree : largest) {
+            if (subtree.value == &value && subtree.path.empty() && &value != &root) {
+                subtree.path = path;
+                missing--;
+            }
+        }
+        size_t length = path.size();
+        if (value.type == ConType::Array) {
+            for (size_t i = 0; i < value.array->values.size() && missing; i++) {
+                path += '[' + std::to_string(i) + ']';
+                walk(walk, value.array->values[i]);
+                path.resize(length);
+            }
+        } else if (value.type == ConType::Object) {
+            for (auto it = value.object->values.begin(); it != value.object->values.end() && missing; ++it) {
+                if (length) {
+                    path += '.';
+                }
+                path += it->first;
+                walk(walk, it->second);
+                path.resize(length);
+            }
+        }
+    };
+    walk(walk, root);
+}
+
+void ConValue::write(ConWriter& writer, uint64_t level) {
+    bool compact = writer.format.has(CON_FLAG_COMPACT);
+    uint64_t id;
+    if (writer.sharedId(*this, id)) {
+        writer.put(CON_TAG_REFERENCE);
+        writer.writeSize(id);
+        return;
+    }
+
+    // we will write the type first
+    // compact documents fold booleans and small integers into it
+    if (compact && type == ConType::Boolean) {
+        writer.put(boolean ? CON_TAG_TRUE : CON_TAG_FALSE);
+        return;
+    } else if (compact && type == ConType::Integer && integer >= 0 && integer < 0x80) {
+        writer.put(CON_TAG_SMALL_INTEGER | (uint8_t)integer);
+        return;
+    }
+    size_t start = writer.size();
+    // the payload sizes, if it ends up compressed (for ConWriteOptions::stats)
+    uint64_t rawBytes = 0;
+    uint64_t compressedBytes = 0;
+    writer.put((uint8_t)type);
+
+    // then we will write the codec (0 if it isn't compressed),
+    // if it is, we append the compressed byte count, then the compressed data
+    // otherwise, just write the data (size isn't needed because of how the format is designed)
+    // version 1+ always writes the byte count, and the decompressed byte count after it if compressed
+    // whether something gets compressed is up to the policy in ConWriteOptions
+    bool sized = writer.format.version >= 1;
+    switch (type) {
+        case ConType::Null:
+            break;
+        case ConType::Boolean:
+            writer.write(boolean);
+            break;
+        case ConType::Integer:
+            if (compact) {
+                writer.writeVarint(conZigzag(integer));
+            } else {
+                writer.write(integer);
+            }
+            break;
+        case ConType::Float:
+            writer.write(floating);
+            break;
+        case ConType::String: {
+            std::pmr::string& str = string;
+            std::vector<uint8_t> compressed;
+            if (writer.shouldCompress(*this, level, (const uint8_t*)str.data(), str.size())) {
+                compressed = writer.compress((const uint8_t*)str.data(), str.size());
+            }
+            if (!compressed.empty()) {
+                uint64_t size = compressed.size();
+                writer.put((uint8_t)writer.codec->id);
+                writer.writeSize(size);
+                if (sized) {
+                    writer.writeSize(str.size());
+                }
+                writer.write(compressed.data(), size);
+                rawBytes = str.size();
+                compressedBytes = size;
+            } else {
+                uint64_t size = str.size();
+                writer.put(0);
+                writer.writeSize(size);
+                writer.write(str.c_str(), size);
+            }
+            break;
+        }
+        case ConType::Array:
+        case ConType::Object: {
+            if (type == ConType::Array && writer.columnar(*array)) {
+                writer.writeColumns(*this, level);
+                break;
+            } else if (type == ConType::Array && writer.packable(*array)) {
+                writer.writePacked(*this, level);
+                break;
+            }
+            // the payload is encoded in place, right after its header
+            // if this level can be compressed we also reserve room for the compressed byte count,
+            // uncompressed version 0 payloads don't have one, so it is removed again if we end up not compressing
+            // (usually only happens below the threshold, so that move is cheap)
+            bool compressible = writer.compressible(level);
+            size_t header = writer.reserve(compressible || sized ? 1 + sizeof(uint64_t) : 1);
+            size_t payload = writer.size();
+            bool blocking = type == ConType::Array && writer.blocking();
+            std::vector<size_t> starts;
+            if (type == ConType::Array) {
+                array->write(writer, level, blocking ? &starts : nullptr);
+            } else {
+                object->write(writer, level);
+            }
+            if (blocking && writer.writeBlocks(*this, level, header, starts)) {
+                break;
+            }
+            uint64_t payloadSize = writer.size() - payload;
+            std::vector<uint8_t> compressed;
+            if (writer.shouldCompress(*this, level, writer.data(payload), payloadSize)) {
+                compressed = writer.compress(writer.data(payload), payloadSize);
+            }
+            if (!compressed.empty()) {
+                uint64_t size = compressed.size();
+                writer.truncate(header);
+                writer.put((uint8_t)writer.codec->id);
+                writer.writeSize(size);
+                if (sized) {
+                    writer.writeSize(payloadSize);
+                }
+                writer.write(compressed.data(), size);
+                rawBytes = payloadSize;
+                compressedBytes = size;
+            } else {
+                if (sized) {
+                    writer.patch(header + 1, payloadSize);
+                } else if (compressible) {
+                    writer.erase(header + 1, sizeof(uint64_t));
+                }
+                writer.patch(header, (uint8_t)0);
+            }
+        } break;
+        default:
+            ConLog() << "Invalid type: " << (int)type;
+            break;      
+    }
+    if (writer.options.stats && (type == ConType::String || type == ConType::Array || type == ConType::Object)) {
+        writer.options.stats->record(level, type, writer.size() - start, compressedBytes != 0, rawBytes, compressedBytes, this);
+    }
+}
+
+// allocations a decoded value made itself, not counting the values inside of it (see ConStats::allocations)
+uint64_t conAllocations(const ConValue& value) {
+    const static size_t INLINE = std::pmr::string().capacity();
+    switch (value.type) {
+        case ConType::String:
+            return value.string.capacity() > INLINE;
+        case ConType::Array:
+            return 1 + (value.array->values.capacity() != 0);
+        case ConType::Object: {
+            uint64_t count = 1 + (value.object->values.entries.capacity() != 0);
+            for (const auto& [key, element] : value.object->values) {
+                count += key.capacity() > INLINE;
+            }
+            return count;
+        }
+        default:
+            return 0;
+    }
+}
+
+void ConValue::read(std::istream& stream, std::pmr::memory_resource* resource, unsigned threads, bool share, ConStats* stats) {
+    auto start = std::chrono::steady_clock::now();
+    std::streampos begin = stats ? stream.tellg() : std::streampos(-1);
+    ConFormat format;
+    if (!format.read(stream)) {
+        reset();
+        stream.setstate(std::ios::failbit);
+        return;
+    }
+    std::optional<ConThreadPool> pool;
+    if (threads != 1) {
+        // the calling thread decodes blocks too
+        pool.emplace(std::max(threads ? threads : std::thread::hardware_concurrency(), 2u) - 1);
+    }
+    ConReader reader{stream, format, pool ? &*pool : nullptr};
+    reader.stats = stats;
+    // the shared subtrees are decoded once, in order, so each of them can use the ones before it
+    std::vector<ConValue> shared;
+    shared.reserve(format.shared.size());
+    for (size_t i = 0; i < format.shared.size() && stream; i++) {
+        size_t size;
+        const uint8_t* data = format.sharedValue(i, size);
+        ConMemoryBuffer buffer(data, size);
+        std::istream sharedStream(&buffer);
+        ConReader inner{sharedStream, format, nullptr, &shared, share, i, 0, stats};
+        shared.emplace_back().read(inner, resource);
+        if (!sharedStream) {
+            stream.setstate(std::ios::failbit);
+        }
+    }
+    reader.shared = &shared;
+    reader.share = share;
+    if (stream) {
+        read(reader, resource);
+    }
+    if (stats) {
+        std::streampos end = begin != std::streampos(-1) && stream ? stream.tellg() : std::streampos(-1);
+        stats->document(start, end != std::streampos(-1) ? (uint64_t)(end - begin) : 0);
+    }
+}
+
+void ConValue::read(ConReader& reader, std::pmr::memory_resource* resource) {
+    reset();
+    std::istream& stream = reader.stream;
+    // the payload sizes, if it is compressed (for ConReader::stats)
+    uint64_t rawBytes = 0;
+    uint64_t compressedBytes = 0;
+    bool sized = reader.format.version >= 1;
+    bool compact = reader.format.has(CON_FLAG_COMPACT);
+    uint8_t type;
+    stream.read((char*)&type, sizeof(uint8_t));
+    if (type == CON_TAG_REFERENCE && reader.format.has(CON_FLAG_SHARED)) {
+        uint64_t index;
+        size_t size;
+        const uint8_t* data = reader.readReference(index, size);
+        if (!data) {
+            return;
+        } else if (reader.shared && index < reader.shared->size()) {
+            const ConValue& shared = (*reader.shared)[index];
+            *this = reader.share ? conShare(shared, resource) : ConValue(shared, resource);
+            return;
+        }
+        // without the decoded table (e.g. for views) it is decoded in place
+        ConMemoryBuffer buffer(data, size);
+        std::istream sharedStream(&buffer);
+        ConReader inner = reader.part(sharedStream);
+        inner.sharedLimit = index;
+        read(inner, resource);
+        if (!sharedStream) {
+            stream.setstate(std::ios::failbit);
+        }
+        return;
+    }
+    if (compact && conTagType(type) != (ConType)type) {
+        if (type >= CON_TAG_SMALL_INTEGER) {
+            integer = type & 0x7f;
+        } else {
+            boolean = type == CON_TAG_TRUE;
+        }
+        this->type = conTagType(type);
+        return;
+    }
+    switch ((ConType)type) {
+        case ConType::Null:
+            break;
+        case ConType::Boolean:
+            stream.read((char*)&boolean, sizeof(bool));
+            break;
+        case ConType::Integer:
+            if (compact) {
+                uint64_t value;
+                reader.readVarint(value);
+                integer = conUnzigzag(value);
+            } else {
+                stream.read((char*)&integer, sizeof(int64_t));
+            }
+            break;
+        case ConType::Float:
+            stream.read((char*)&floating, sizeof(double));
+            break;
+        case ConType::String: {
+            // constructed right away so it is destroyed properly if reading fails
+            new (&string) std::pmr::string(resource);
+            this->type = ConType::String;
+            uint8_t compressed;
+            stream.read((char*)&compressed, sizeof(uint8_t));
+            uint64_t size;
+            uint64_t rawSize = 0;
+            if (!reader.readSize(size)) {
+                break;
+            }
+            if (compressed && sized) {
+                reader.readSize(rawSize);
+            }
+            if (compressed == (uint8_t)ConCodecId::Zlib) {
+                // inflated straight into the string
+                ConInflateBuffer inflater(stream, size, reader.format.dictionary.get(), reader.stats);
+                if (!conInflateString(inflater, rawSize, string)) {
+                    stream.setstate(std::ios::failbit);
+                }
+            } else if (compressed) {
+                std::vector<uint8_t> data;
+                if (!conReadBytes(stream, data, size)) {
+                    break;
+                }
+                std::vector<uint8_t> decompressed = conDecompress(compressed, data.data(), size, rawSize, reader.format.dictionary.get(), reader.stats);
+                // version 0 doesn't store the size, only zlib can be used there anyway
+                if (sized ? decompressed.size() != rawSize : decompressed.empty()) {
+                    stream.setstate(std::ios::failbit);
+                    break;
+                }
+                string.assign(decompressed.begin(), decompressed.end());
+            } else {
+                conReadBytes(stream, string, size);
+            }
+            if (compressed) {
+                rawBytes = string.size();
+                compressedBytes = size;
+            }
+            break;
+        }
+        case ConType::Array:
+        case ConType::Object: {
+            uint8_t compressed;
+            stream.read((char*)&compressed, sizeof(uint8_t));
+            if ((ConType)type == ConType::Array) {
+                array = conNewNode(resource, ConArray(resource));
+            } else {
+                object = conNewNode(resource, ConObject(resource));
+            }
+            // set the type right away so the node is freed if reading fails
+            this->type = (ConType)type;
+            // for the elements
+            reader.depth++;
+            if (compressed == CON_BLOCKED && this->type == ConType::Array && sized) {
+                array->readBlocks(reader);
+            } else if (compressed == CON_COLUMNAR && this->type == ConType::Array && sized) {
+                array->readColumns(reader);
+            } else if (compressed == CON_PACKED && this->type == ConType::Array && sized) {
+                array->readPacked(reader);
+            } else if (compressed) {
+                uint64_t size;
+                uint64_t rawSize = 0;
+                reader.readSize(size);
+                if (sized) {
+                    reader.readSize(rawSize);
+                }
+                // zlib is inflated while the payload is parsed, the other codecs only have whole buffer apis
+                std::optional<ConInflateBuffer> inflater;
+                std::vector<uint8_t> decompressed;
+                std::optional<ConMemoryBuffer> memory;
+                std::streambuf* buffer;
+                if (compressed == (uint8_t)ConCodecId::Zlib) {
+                    buffer = &inflater.emplace(stream, size, reader.format.dictionary.get(), reader.stats);
+                } else {
+                    std::vector<uint8_t> data;
+                    conReadBytes(stream, data, size);
+                    decompressed = conDecompress(compressed, data.data(), size, rawSize, reader.format.dictionary.get(), reader.stats);
+                    if (!stream || (decompressed.empty() && rawSize != 0)) {
+                        stream.setstate(std::ios::failbit);
+                        reader.depth--;
+                        break;
+                    }
+                    buffer = &memory.emplace(decompressed.data(), decompressed.size());
+                }
+                rawBytes = rawSize;
+                compressedBytes = size;
+                std::istream bufferStream(buffer);
+                ConReader inner = reader.part(bufferStream);
+                if (this->type == ConType::Array) {
+                    array->read(inner);
+                } else {
+                    object->read(inner);
+                }
+                if (inflater) {
+                    inflater->finish();
+                }
+                if (!bufferStream || (inflater && !inflater->good())) {
+                    stream.setstate(std::ios::failbit);
+                }
+            } else {
+                if (sized) {
+                    // always fixed width, see CON_FLAG_COMPACT
+                    stream.ignore(sizeof(uint64_t));
+                }
+                if (this->type == ConType::Array) {
+                    array->read(reader);
+                } else {
+                    object->read(reader);
+                }
+            }
+            reader.depth--;
+            break;
+        }
+        default:
+            ConLog() << "Invalid type: " << (int)type;
+            stream.setstate(std::ios::failbit);
+            return;
+    }
+    this->type = (ConType)type;
+    if (reader.stats && (this->type == ConType::String || this->type == ConType::Array || this->type == ConType::Object)) {
+        reader.stats->record(reader.depth, this->type, 0, compressedBytes != 0, rawBytes, compressedBytes);
+        reader.stats->allocated(conAllocations(*this));
+    }
+}
+
+// bump allocator for decoded documents
+// every node, string and container buffer of a document read through the arena is allocated from it,
+// nothing is freed individually, reset() drops all documents at once without walking them
+// an arena is not thread safe, use one per thread (or per request)
+struct ConArena {
+    std::pmr::monotonic_buffer_resource resource;
+
+    ConArena(size_t initialSize=64 * 1024) : resource(initialSize) {}
+    ConArena(const ConArena&) = delete;
+    ConArena& operator=(const ConArena&) = delete;
+
+    std::pmr::memory_resource* get() {
+        return &resource;
+    }
+
+    // the returned values live inside the arena and are valid until reset(), they must not be destroyed by hand
+    // anything added to them afterwards should be allocated from the arena as well, otherwise it leaks on reset()
+    ConValue& create() {
+        return *std::pmr::polymorphic_allocator<ConValue>(&resource).new_object<ConValue>();
+    }
+
+    ConValue& read(std::istream& stream) {
+        ConValue& value = create();
+        value.read(stream, &resource);
+        return value;
+    }
+
+    ConValue& readJson(std::istream& stream);
+    ConValue& readJson(std::string_view json);
+
+    void reset() {
+        resource.release();
+    }
+};
+
+// converting con to json
+
+// longest output of conFormatNumber
+const static size_t CON_NUMBER_SIZE = 32;
+
+// writes an integer or float as json text into `buffer` and returns its length
+// floats use the shortest text that reads back as the same double, and always get a '.' or an exponent
+// so they come back as floats, json has no infinity or nan so those become null
+size_t conFormatNumber(char* buffer, const ConValue& value) {
+    if (value.type == ConType::Integer) {
+        return std::to_chars(buffer, buffer + CON_NUMBER_SIZE, value.integer).ptr - buffer;
+    }
+    if (!std::isfinite(value.floating)) {
+        std::memcpy(buffer, "null", 4);
+        return 4;
+    }
+    char* end = std::to_chars(buffer, buffer + CON_NUMBER_SIZE - 2, value.floating).ptr;
+    if (std::find_if(buffer, end, [](char c) { return c == '.' || c == 'e'; }) == end) {
+        *end++ = '.';
+        *end++ = '0';
+    }
+    return end - buffer;
+}
+
+// skips to the first byte of a json string that needs a closer look: a quote, a backslash, a control character or non-ascii
+// checks 8 bytes at a time, then finds the exact byte one by one
+const char* conScanString(const char* p, const char* end) {
+    const uint64_t ONES = 0x0101010101010101ull;
+    const uint64_t HIGH = 0x8080808080808080ull;
+    while (end - p >= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+        uint64_t quote = word ^ (ONES * '"');
+        uint64_t backslash = word ^ (ONES * '\\');
+        uint64_t special = ((quote - ONES) & ~quote) | ((backslash - ONES) & ~backslash) | ((word - ONES * 0x20) & ~word) | word;
+        if (special & HIGH) {
+            break;
+        }
+        p += 8;
+    }
+    while (p < end && *p != '"' && *p != '\\' && (uint8_t)*p >= 0x20 && (uint8_t)*p < 0x80) {
+        p++;
+    }
+    return p;
 }
 
-std::ostream& operator<<(std::ostream& os, ConValue& value) {
-    switch (value.type) {
-        case ConType::Null:
-            os << "null";
-            break;
-        case ConType::Boolean:
-            os << (CON_CAST(value, Boolean) ? "true" : "false");
-            break;
-        case ConType::Integer:
-            os << CON_CAST(value, Integer);
-            break;
-        case ConType::Float:
-            os << CON_CAST(value, Float);
-            break;
-        case ConType::String:
-            os << '"' << CON_CAST(value, String) << '"';
-            break;
-        case ConType::Array:
-            os << CON_CAST(value, Array);
-            break;
-        case ConType::Object:
-            os << CON_CAST(value, Object);
-            break;
-        default:
-            os << "Invalid type";
-            break;
+enum class ConJsonStyle {
+    // no whitespace at all
+    Compact,
+    // a space after every ',' and ':', all on one line (what operator<< writes)
+    Spaced,
+    // one value per line, indented
+    Pretty
+};
+
+// writes json into a buffer that is reused between documents,
+// with a stream it is flushed whenever it gets big, so huge documents don't have to fit in memory twice
+struct ConJsonWriter {
+    std::string buffer;
+    std::ostream* stream;
+    ConJsonStyle style;
+    // spaces per level when pretty
+    size_t indent = 2;
+
+    const static size_t FLUSH_SIZE = 64 * 1024;
+
+    ConJsonWriter(ConJsonStyle style=ConJsonStyle::Compact, std::ostream* stream=nullptr) : stream(stream), style(style) {}
+
+    ~ConJsonWriter() {
+        flush();
+    }
+
+    // what was written since the last flush
+    std::string_view view() const {
+        return buffer;
+    }
+
+    void clear() {
+        buffer.clear();
+    }
+
+    void flush() {
+        if (stream && !buffer.empty()) {
+            stream->write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
+
+    void write(const ConValue& value) {
+        write(value, 0);
+        flush();
+    }
+
+    void write(const ConArray& arr) {
+        write(arr, 0);
+        flush();
+    }
+
+    void write(const ConObject& obj) {
+        write(obj, 0);
+        flush();
+    }
+
+    void writeString(std::string_view str) {
+        buffer += '"';
+        const char* p = str.data();
+        const char* end = p + str.size();
+        while (true) {
+            const char* run = p;
+            p = conScanString(p, end);
+            buffer.append(run, p - run);
+            if (p >= end) {
+                break;
+            }
+            uint8_t c = *p++;
+            switch (c) {
+                case '"': buffer += "\\\""; break;
+                case '\\': buffer += "\\\\"; break;
+                case '\b': buffer += "\\b"; break;
+                case '\f': buffer += "\\f"; break;
+                case '\n': buffer += "\\n"; break;
+                case '\r': buffer += "\\r"; break;
+                case '\t': buffer += "\\t"; break;
+                default:
+                    if (c < 0x20) {
+                        const char* HEX = "0123456789abcdef";
+                        char escape[6] = {'\\', 'u', '0', '0', HEX[c >> 4], HEX[c & 15]};
+                        buffer.append(escape, sizeof(escape));
+                    } else {
+                        // utf-8 is written as is
+                        buffer += (char)c;
+                    }
+                    break;
+            }
+        }
+        buffer += '"';
+    }
+
+    // building blocks for writing json piece by piece, `depth` is the nesting level of what comes next
+
+    // before every element, also a good place to flush since nothing is half written
+    void separate(bool& first, size_t depth) {
+        if (stream && buffer.size() >= FLUSH_SIZE) {
+            flush();
+        }
+        if (!first) {
+            buffer += style == ConJsonStyle::Spaced ? ", " : ",";
+        }
+        first = false;
+        newline(depth);
+    }
+
+    // an object key and the ':' after it
+    void key(std::string_view key) {
+        writeString(key);
+        buffer += style == ConJsonStyle::Compact ? ":" : ": ";
+    }
+
+    // before the closing bracket, empty containers stay on one line
+    void close(bool empty, size_t depth) {
+        if (!empty) {
+            newline(depth);
+        }
+    }
+
+    void newline(size_t depth) {
+        if (style == ConJsonStyle::Pretty) {
+            buffer += '\n';
+            buffer.append(depth * indent, ' ');
+        }
+    }
+
+private:
+    void write(const ConValue& value, size_t depth) {
+        switch (value.type) {
+            case ConType::Null:
+                buffer += "null";
+                break;
+            case ConType::Boolean:
+                buffer += value.boolean ? "true" : "false";
+                break;
+            case ConType::Integer:
+            case ConType::Float: {
+                char number[CON_NUMBER_SIZE];
+                buffer.append(number, conFormatNumber(number, value));
+                break;
+            }
+            case ConType::String:
+                writeString(value.string);
+                break;
+            case ConType::Array:
+                write(*value.array, depth);
+                break;
+            case ConType::Object:
+                write(*value.object, depth);
+                break;
+            default:
+                buffer += "Invalid type";
+                break;
+        }
+    }
+
+    void write(const ConArray& arr, size_t depth) {
+        buffer += '[';
+        bool first = true;
+        for (const ConValue& value : arr.values) {
+            separate(first, depth + 1);
+            write(value, depth + 1);
+        }
+        close(first, depth);
+        buffer += ']';
+    }
+
+    void write(const ConObject& obj, size_t depth) {
+        buffer += '{';
+        bool first = true;
+        for (auto& [key, value] : obj.values) {
+            separate(first, depth + 1);
+            this->key(key);
+            write(value, depth + 1);
+        }
+        close(first, depth);
+        buffer += '}';
     }
+};
+
+std::ostream& operator<<(std::ostream& os, const ConArray& arr) {
+    ConJsonWriter(ConJsonStyle::Spaced, &os).write(arr);
+    return os;
+}
+
+std::ostream& operator<<(std::ostream& os, const ConObject& obj) {
+    ConJsonWriter(ConJsonStyle::Spaced, &os).write(obj);
+    return os;
+}
+
+std::ostream& operator<<(std::ostream& os, const ConValue& value) {
+    ConJsonWriter(ConJsonStyle::Spaced, &os).write(value);
     return os;
 }
 
@@ -482,156 +4069,932 @@ void eliminateWhitespace(std::istream& is) {
     }
 }
 
-std::istream& operator>>(std::istream& is, ConValue& value);
+// stage 1 of parsing json: finds every structural character ({}[]:,), both quotes of every string
+// and the first byte of every other value, 64 bytes at a time, so the parser can jump from one to the next
+// without looking at whitespace or string contents
+// the character classes are found with avx2 or neon when the cpu has them, the rest is plain bit twiddling
 
-std::istream& operator>>(std::istream& is, ConArray& arr) {
-    char c;
-    eliminateWhitespace(is);
-    is >> c;
-    if (c != '[') {
-        is.setstate(std::ios::failbit);
-        std::cout << "Failed to read array: no '['" << std::endl;
-        return is;
+enum class ConSimd {
+    None,
+    Avx2,
+    Neon
+};
+
+// the best kernel this cpu supports
+ConSimd conSimdSupport() {
+#if defined(__aarch64__) || defined(_M_ARM64)
+    return ConSimd::Neon;
+#elif (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2 ? ConSimd::Avx2 : ConSimd::None;
+#else
+    return ConSimd::None;
+#endif
+}
+
+// one bit per byte of a 64 byte block
+struct ConJsonBlock {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t op;
+    uint64_t whitespace;
+    // below 0x20, not allowed inside strings
+    uint64_t control;
+    // 0x80 and up, utf-8 has to be checked
+    uint64_t high;
+};
+
+ConJsonBlock conClassifyScalar(const uint8_t* block) {
+    // class bits per byte value
+    const static auto TABLE = [] {
+        std::array<uint8_t, 256> table = {};
+        table['"'] = 1;
+        table['\\'] = 2;
+        for (char c : {'{', '}', '[', ']', ':', ','}) {
+            table[(uint8_t)c] = 4;
+        }
+        for (char c : {' ', '\t', '\n', '\r'}) {
+            table[(uint8_t)c] |= 8;
+        }
+        for (size_t c = 0; c < 0x20; c++) {
+            table[c] |= 16;
+        }
+        for (size_t c = 0x80; c < 0x100; c++) {
+            table[c] = 32;
+        }
+        return table;
+    }();
+    ConJsonBlock masks = {};
+    for (size_t i = 0; i < 64; i++) {
+        uint8_t c = TABLE[block[i]];
+        masks.quote |= (uint64_t)(c & 1) << i;
+        masks.backslash |= (uint64_t)((c >> 1) & 1) << i;
+        masks.op |= (uint64_t)((c >> 2) & 1) << i;
+        masks.whitespace |= (uint64_t)((c >> 3) & 1) << i;
+        masks.control |= (uint64_t)((c >> 4) & 1) << i;
+        masks.high |= (uint64_t)((c >> 5) & 1) << i;
     }
-    // check if it an empty array
-    eliminateWhitespace(is);
-    is >> c;
-    if (c == ']') {
-        eliminateWhitespace(is);
-        return is;
+    return masks;
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+// (lambdas don't inherit the target attribute, so everything is spelled out)
+__attribute__((target("avx2")))
+ConJsonBlock conClassifyAvx2(const uint8_t* block) {
+    ConJsonBlock masks = {};
+    for (size_t half = 0; half < 2; half++) {
+        __m256i c = _mm256_loadu_si256((const __m256i*)(block + half * 32));
+        // '[' and ']' are '{' and '}' without the 0x20 bit
+        __m256i lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+        __m256i quote = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('"'));
+        __m256i backslash = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\\'));
+        __m256i op = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(lower, _mm256_set1_epi8('{')), _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('}'))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(':')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8(','))));
+        __m256i whitespace = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\t'))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\r'))));
+        __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(c, _mm256_set1_epi8(0x1F)), c);
+        size_t shift = half * 32;
+        masks.quote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(quote) << shift;
+        masks.backslash |= (uint64_t)(uint32_t)_mm256_movemask_epi8(backslash) << shift;
+        masks.op |= (uint64_t)(uint32_t)_mm256_movemask_epi8(op) << shift;
+        masks.whitespace |= (uint64_t)(uint32_t)_mm256_movemask_epi8(whitespace) << shift;
+        masks.control |= (uint64_t)(uint32_t)_mm256_movemask_epi8(control) << shift;
+        masks.high |= (uint64_t)(uint32_t)_mm256_movemask_epi8(c) << shift;
     }
-    is.putback(c);
-    while (true) {
-        ConValue value;
-        eliminateWhitespace(is);
-        is >> value;
-        arr.values.push_back(value);
-        eliminateWhitespace(is);
-        is >> c;
-        if (c == ']') {
-            break;
-        } else if (c != ',') {
-            is.setstate(std::ios::failbit);
-            std::cout << "Failed to read array: no ',': '" << c << '\'' << std::endl;
-            return is;
+    return masks;
+}
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+ConJsonBlock conClassifyNeon(const uint8_t* block) {
+    uint8x16_t c[4];
+    for (size_t i = 0; i < 4; i++) {
+        c[i] = vld1q_u8(block + i * 16);
+    }
+    // one bit per lane, then pairwise adds squash 64 lanes into 64 bits
+    auto mask = [&](auto match) {
+        const uint8x16_t bits = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+        uint8x16_t m[4];
+        for (size_t i = 0; i < 4; i++) {
+            m[i] = vandq_u8(match(c[i]), bits);
+        }
+        uint8x16_t sum = vpaddq_u8(vpaddq_u8(m[0], m[1]), vpaddq_u8(m[2], m[3]));
+        sum = vpaddq_u8(sum, sum);
+        return vgetq_lane_u64(vreinterpretq_u64_u8(sum), 0);
+    };
+    auto eq = [](uint8x16_t v, char value) {
+        return vceqq_u8(v, vdupq_n_u8((uint8_t)value));
+    };
+    ConJsonBlock masks;
+    masks.quote = mask([&](uint8x16_t v) { return eq(v, '"'); });
+    masks.backslash = mask([&](uint8x16_t v) { return eq(v, '\\'); });
+    masks.op = mask([&](uint8x16_t v) {
+        uint8x16_t lower = vorrq_u8(v, vdupq_n_u8(0x20));
+        return vorrq_u8(vorrq_u8(eq(lower, '{'), eq(lower, '}')), vorrq_u8(eq(v, ':'), eq(v, ',')));
+    });
+    masks.whitespace = mask([&](uint8x16_t v) {
+        return vorrq_u8(vorrq_u8(eq(v, ' '), eq(v, '\t')), vorrq_u8(eq(v, '\n'), eq(v, '\r')));
+    });
+    masks.control = mask([&](uint8x16_t v) { return vcltq_u8(v, vdupq_n_u8(0x20)); });
+    masks.high = mask([&](uint8x16_t v) { return vcgeq_u8(v, vdupq_n_u8(0x80)); });
+    return masks;
+}
+#endif
+
+// checks that the whole buffer is valid utf-8, ascii is skipped 8 bytes at a time
+bool conValidUtf8(const uint8_t* p, const uint8_t* end) {
+    while (p < end) {
+        if (end - p >= 8) {
+            uint64_t word;
+            std::memcpy(&word, p, sizeof(word));
+            if (!(word & 0x8080808080808080ull)) {
+                p += 8;
+                continue;
+            }
+        }
+        uint8_t lead = *p;
+        if (lead < 0x80) {
+            p++;
+            continue;
+        }
+        // the allowed range of the second byte rules out overlong forms and surrogates
+        size_t length;
+        uint8_t low = 0x80, high = 0xBF;
+        if (lead >= 0xC2 && lead <= 0xDF) {
+            length = 2;
+        } else if (lead >= 0xE0 && lead <= 0xEF) {
+            length = 3;
+            low = lead == 0xE0 ? 0xA0 : 0x80;
+            high = lead == 0xED ? 0x9F : 0xBF;
+        } else if (lead >= 0xF0 && lead <= 0xF4) {
+            length = 4;
+            low = lead == 0xF0 ? 0x90 : 0x80;
+            high = lead == 0xF4 ? 0x8F : 0xBF;
+        } else {
+            return false;
+        }
+        if ((size_t)(end - p) < length || p[1] < low || p[1] > high) {
+            return false;
+        }
+        for (size_t i = 2; i < length; i++) {
+            if ((p[i] & 0xC0) != 0x80) {
+                return false;
+            }
         }
+        p += length;
     }
-    return is;
+    return true;
 }
 
-std::istream& operator>>(std::istream& is, ConObject& obj) {
-    char c;
-    eliminateWhitespace(is);
-    is >> c;
-    if (c != '{') {
-        is.setstate(std::ios::failbit);
-        std::cout << "Failed to read object: no '{'" << std::endl;
-        return is;
+struct ConJsonIndex {
+    // offsets of the structural bytes, in order
+    std::vector<uint32_t> positions;
+    size_t count = 0;
+
+    // false if the index can't be used: the input is too big for 32 bit offsets, has unterminated strings,
+    // control characters in strings, or invalid utf-8 (the parser without an index reports where)
+    bool build(std::string_view json, ConSimd simd=conSimdSupport()) {
+        count = 0;
+        if (json.size() > UINT32_MAX) {
+            return false;
+        }
+        const uint8_t* data = (const uint8_t*)json.data();
+        size_t size = json.size();
+        positions.resize(std::max<size_t>(positions.size(), size / 4 + 64));
+
+        // carried from one block to the next
+        uint64_t escapedCarry = 0;
+        uint64_t inStringCarry = 0;
+        uint64_t scalarCarry = 0;
+        uint64_t high = 0;
+        uint64_t invalid = 0;
+        for (size_t base = 0; base < size; base += 64) {
+            uint8_t padded[64];
+            const uint8_t* block = data + base;
+            if (size - base < 64) {
+                // the last block is padded with whitespace
+                std::memset(padded, ' ', sizeof(padded));
+                std::memcpy(padded, block, size - base);
+                block = padded;
+            }
+            ConJsonBlock masks = classify(block, simd);
+
+            uint64_t quote = masks.quote & ~escaped(masks.backslash, escapedCarry);
+            // set from each opening quote up to (not including) its closing quote
+            uint64_t inString = prefixXor(quote) ^ inStringCarry;
+            inStringCarry = (uint64_t)((int64_t)inString >> 63);
+            // the first byte of numbers and literals, anything that isn't whitespace, an operator or a quote
+            // and doesn't follow one of those either
+            uint64_t scalar = ~(masks.op | masks.whitespace | masks.quote);
+            uint64_t follows = (scalar << 1) | scalarCarry;
+            scalarCarry = scalar >> 63;
+            uint64_t structural = ((masks.op | (scalar & ~follows)) & ~inString) | quote;
+            invalid |= masks.control & inString;
+            high |= masks.high;
+
+            if (count + 64 > positions.size()) {
+                positions.resize(positions.size() * 2 + 64);
+            }
+            while (structural) {
+                positions[count++] = (uint32_t)(base + std::countr_zero(structural));
+                structural &= structural - 1;
+            }
+        }
+        if (inStringCarry || invalid) {
+            return false;
+        }
+        if (high && !conValidUtf8(data, data + size)) {
+            return false;
+        }
+        return true;
     }
-    // check if it an empty object
-    eliminateWhitespace(is);
-    is >> c;
-    if (c == '}') {
-        eliminateWhitespace(is);
-        return is;
+
+private:
+    static ConJsonBlock classify(const uint8_t* block, ConSimd simd) {
+        switch (simd) {
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+            case ConSimd::Avx2:
+                return conClassifyAvx2(block);
+#endif
+#if defined(__aarch64__) || defined(_M_ARM64)
+            case ConSimd::Neon:
+                return conClassifyNeon(block);
+#endif
+            default:
+                return conClassifyScalar(block);
+        }
+    }
+
+    // bit i is set if byte i comes right after an odd number of backslashes
+    static uint64_t escaped(uint64_t backslash, uint64_t& carry) {
+        const uint64_t EVEN = 0x5555555555555555ull;
+        const uint64_t ODD = ~EVEN;
+        uint64_t starts = backslash & ~(backslash << 1);
+        // a run continued from the last block counts as starting on the other parity
+        uint64_t evenStartMask = EVEN ^ carry;
+        uint64_t evenStarts = starts & evenStartMask;
+        uint64_t oddStarts = starts & ~evenStartMask;
+        uint64_t evenCarries = backslash + evenStarts;
+        uint64_t oddCarries = backslash + oddStarts;
+        bool overflow = oddCarries < backslash;
+        oddCarries |= carry;
+        carry = overflow ? 1 : 0;
+        uint64_t evenEnds = evenCarries & ~backslash & ODD;
+        uint64_t oddEnds = oddCarries & ~backslash & EVEN;
+        return evenEnds | oddEnds;
+    }
+
+    // bit i is the xor of bits 0 to i
+    static uint64_t prefixXor(uint64_t bits) {
+        bits ^= bits << 1;
+        bits ^= bits << 2;
+        bits ^= bits << 4;
+        bits ^= bits << 8;
+        bits ^= bits << 16;
+        bits ^= bits << 32;
+        return bits;
     }
-    is.putback(c);
-
-    while (true) {
-        std::string key;
-        eliminateWhitespace(is);
-        is >> c;
-        if (c != '"') {
-            is.setstate(std::ios::failbit);
-            std::cout << "Failed to read object: no '\"'" << std::endl;
-            return is;
-        }
-        std::getline(is, key, '"');
-        eliminateWhitespace(is);
-        is >> c;
-        if (c != ':') {
-            is.setstate(std::ios::failbit);
-            std::cout << "Failed to read object: no ':'" << std::endl;
-            return is;
-        }
-        ConValue value;
-        eliminateWhitespace(is);
-        is >> value;
-        if (is.fail()) {
-            std::cout << "Failed to read object: failed to read value" << std::endl;
-            return is;
-        }
-        obj.values[key] = value;
-        eliminateWhitespace(is);
-        is >> c;
-        if (c == '}') {
-            break;
-        } else if (c != ',') {
-            is.setstate(std::ios::failbit);
-            std::cout << "Failed to read object: no ',': '" << c << '\'' << std::endl;
-            return is;
+};
+
+// container size in events when it isn't known up front (json)
+const static uint64_t CON_SIZE_UNKNOWN = UINT64_MAX;
+
+// parses json straight out of a contiguous buffer (a string, a mapped file),
+// strings without escapes are copied in one go, and keys without escapes aren't copied at all until they're inserted
+// with an index from stage 1 it jumps between structural bytes instead of skipping whitespace,
+// and strings are taken between their quotes without scanning them again
+struct ConJsonParser {
+    const char* begin;
+    const char* p;
+    const char* end;
+    // set when parsing fails, p is left where it happened
+    const char* error = nullptr;
+    // nesting limit, so hostile input can't overflow the stack
+    size_t maxDepth = 1024;
+
+    // the index has to be built from the same buffer, and outlive the parser
+    ConJsonParser(std::string_view json, const ConJsonIndex* index=nullptr) : begin(json.data()), p(json.data()), end(json.data() + json.size()) {
+        if (index) {
+            structural = index->positions.data();
+            structuralCount = index->count;
         }
     }
-    return is;
-}
 
-std::istream& operator>>(std::istream& is, ConValue& value) {
-    char c;
-    eliminateWhitespace(is);
-    is.get(c);
-    is.putback(c);
-    if (c == 'n') {
-        value.type = ConType::Null;
-    } else if (c == 't' || c == 'f') {
-        bool b;
-        eliminateWhitespace(is);
-        b = c == 't';
-        // use up all the characters
-        for (size_t i = 0; i < (b ? 4 : 5); i++) {
-            is.get(c);
-        }
-        value = ConValue((bool)b);
-    } else if (c == '"') {
-        std::string str;
-        eliminateWhitespace(is);
-        is.get(c);
-        if (c != '"') {
-            std::cerr << "Failed to read string: no '\"'" << std::endl;
-            is.setstate(std::ios::failbit);
+    size_t offset() const {
+        return p - begin;
+    }
+
+    bool fail(const char* message) {
+        if (!error) {
+            error = message;
+        }
+        return false;
+    }
+
+    void skipWhitespace() {
+        if (structural) {
+            // anything skipped here that isn't whitespace is caught by the checks after numbers and literals
+            size_t at = p - begin;
+            while (next < structuralCount && structural[next] < at) {
+                next++;
+            }
+            p = next < structuralCount ? begin + structural[next] : end;
+            return;
+        }
+        while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) {
+            p++;
+        }
+    }
+
+    bool parse(ConValue& value, std::pmr::memory_resource* resource, size_t depth=0) {
+        skipWhitespace();
+        if (p >= end) {
+            return fail("unexpected end of input");
+        }
+        switch (*p) {
+            case 'n':
+                value = ConValue();
+                return literal("null");
+            case 't':
+                value = ConValue(true);
+                return literal("true");
+            case 'f':
+                value = ConValue(false);
+                return literal("false");
+            case '"': {
+                std::string_view str;
+                if (!parseString(str)) {
+                    return false;
+                }
+                value = ConValue(std::pmr::string(str, resource));
+                return true;
+            }
+            case '[':
+                if (depth >= maxDepth) {
+                    return fail("nested too deeply");
+                }
+                value = ConValue(ConArray(resource));
+                return parse(*value.array, depth + 1);
+            case '{':
+                if (depth >= maxDepth) {
+                    return fail("nested too deeply");
+                }
+                value = ConValue(ConObject(resource));
+                return parse(*value.object, depth + 1);
+            default:
+                return parseNumber(value);
+        }
+    }
+
+    // arrays and objects allocate their contents from their own resource
+    bool parse(ConArray& arr, size_t depth=0) {
+        skipWhitespace();
+        if (p >= end || *p != '[') {
+            return fail("expected '['");
+        }
+        p++;
+        skipWhitespace();
+        if (p < end && *p == ']') {
+            p++;
+            return true;
+        }
+        while (true) {
+            if (!parse(arr.values.emplace_back(), arr.resource(), depth)) {
+                return false;
+            }
+            skipWhitespace();
+            if (p >= end) {
+                return fail("unexpected end of array");
+            } else if (*p == ']') {
+                p++;
+                return true;
+            } else if (*p != ',') {
+                return fail("expected ',' or ']' in array");
+            }
+            p++;
+        }
+    }
+
+    bool parse(ConObject& obj, size_t depth=0) {
+        // entries are collected in the order of the input, then moved into the object at once and sorted
+        size_t base = pending.size();
+        bool result = parseEntries(obj, depth);
+        obj.values.reserve(obj.values.size() + pending.size() - base);
+        for (size_t i = base; i < pending.size(); i++) {
+            obj.values.entries.push_back(std::move(pending[i]));
+        }
+        pending.erase(pending.begin() + base, pending.end());
+        obj.values.sort();
+        return result;
+    }
+
+    // reports the value to `handler` as events instead of building a tree, see ConHandler in conevents.h
+    // strings and keys are only valid during their event
+    template<typename Handler>
+    bool parseEvents(Handler& handler, size_t depth=0) {
+        skipWhitespace();
+        if (p >= end) {
+            return fail("unexpected end of input");
+        }
+        switch (*p) {
+            case 'n':
+                return literal("null") && accepted(handler.onNull());
+            case 't':
+                return literal("true") && accepted(handler.onBool(true));
+            case 'f':
+                return literal("false") && accepted(handler.onBool(false));
+            case '"': {
+                std::string_view str;
+                return parseString(str) && accepted(handler.onString(str));
+            }
+            case '[': {
+                if (depth >= maxDepth) {
+                    return fail("nested too deeply");
+                }
+                p++;
+                if (!accepted(handler.onStartArray(CON_SIZE_UNKNOWN))) {
+                    return false;
+                }
+                skipWhitespace();
+                if (p < end && *p == ']') {
+                    p++;
+                    return accepted(handler.onEndArray());
+                }
+                while (true) {
+                    if (!parseEvents(handler, depth + 1)) {
+                        return false;
+                    }
+                    skipWhitespace();
+                    if (p >= end) {
+                        return fail("unexpected end of array");
+                    } else if (*p == ']') {
+                        p++;
+                        return accepted(handler.onEndArray());
+                    } else if (*p != ',') {
+                        return fail("expected ',' or ']' in array");
+                    }
+                    p++;
+                }
+            }
+            case '{': {
+                if (depth >= maxDepth) {
+                    return fail("nested too deeply");
+                }
+                p++;
+                if (!accepted(handler.onStartObject(CON_SIZE_UNKNOWN))) {
+                    return false;
+                }
+                skipWhitespace();
+                if (p < end && *p == '}') {
+                    p++;
+                    return accepted(handler.onEndObject());
+                }
+                while (true) {
+                    skipWhitespace();
+                    std::string_view key;
+                    if (p >= end || *p != '"') {
+                        return fail("expected a key");
+                    }
+                    if (!parseString(key) || !accepted(handler.onKey(key))) {
+                        return false;
+                    }
+                    skipWhitespace();
+                    if (p >= end || *p != ':') {
+                        return fail("expected ':' after key");
+                    }
+                    p++;
+                    if (!parseEvents(handler, depth + 1)) {
+                        return false;
+                    }
+                    skipWhitespace();
+                    if (p >= end) {
+                        return fail("unexpected end of object");
+                    } else if (*p == '}') {
+                        p++;
+                        return accepted(handler.onEndObject());
+                    } else if (*p != ',') {
+                        return fail("expected ',' or '}' in object");
+                    }
+                    p++;
+                }
+            }
+            default: {
+                bool floating;
+                int64_t integer;
+                double d;
+                if (!parseNumber(floating, integer, d)) {
+                    return false;
+                }
+                return accepted(floating ? handler.onFloat(d) : handler.onInt(integer));
+            }
+        }
+    }
+
+private:
+    // entries of the objects that are being parsed, an object's entries follow the ones of its parents
+    std::vector<ConEntries::value_type> pending;
+
+    // see parse(ConObject&), adds the entries to `pending`
+    bool parseEntries(ConObject& obj, size_t depth) {
+        skipWhitespace();
+        if (p >= end || *p != '{') {
+            return fail("expected '{'");
+        }
+        p++;
+        skipWhitespace();
+        if (p < end && *p == '}') {
+            p++;
+            return true;
+        }
+        while (true) {
+            skipWhitespace();
+            std::string_view key;
+            if (p >= end || *p != '"') {
+                return fail("expected a key");
+            }
+            if (!parseString(key)) {
+                return false;
+            }
+            skipWhitespace();
+            if (p >= end || *p != ':') {
+                return fail("expected ':' after key");
+            }
+            p++;
+            // the key is copied before the value can reuse the scratch buffer,
+            // duplicate keys keep the last value like before (see ConEntries::sort)
+            std::pmr::string name(key, obj.resource());
+            ConValue value;
+            if (!parse(value, obj.resource(), depth)) {
+                return false;
+            }
+            pending.emplace_back(std::move(name), std::move(value));
+            skipWhitespace();
+            if (p >= end) {
+                return fail("unexpected end of object");
+            } else if (*p == '}') {
+                p++;
+                return true;
+            } else if (*p != ',') {
+                return fail("expected ',' or '}' in object");
+            }
+            p++;
+        }
+    }
+
+    const uint32_t* structural = nullptr;
+    size_t structuralCount = 0;
+    // the first structural byte that hasn't been reached yet
+    size_t next = 0;
+
+    // decoded strings with escapes end up here, only valid until the next string is parsed
+    std::string scratch;
+
+    // handlers return false to stop
+    bool accepted(bool result) {
+        return result || fail("stopped by the handler");
+    }
+
+    // numbers and literals have to be followed by whitespace, ',', ']', '}' or the end
+    bool delimited() const {
+        return p == end || *p == ' ' || *p == '\n' || *p == '\r' || *p == '\t' || *p == ',' || *p == ']' || *p == '}';
+    }
+
+    bool literal(std::string_view word) {
+        if ((size_t)(end - p) < word.size() || std::memcmp(p, word.data(), word.size()) != 0) {
+            return fail("invalid literal");
+        }
+        p += word.size();
+        if (!delimited()) {
+            return fail("invalid literal");
+        }
+        return true;
+    }
+
+    // validates one utf-8 sequence starting at p (a byte >= 0x80), p is moved past it
+    bool skipUtf8() {
+        const uint8_t* s = (const uint8_t*)p;
+        size_t left = end - p;
+        uint8_t lead = s[0];
+        size_t length;
+        // the allowed range of the second byte rules out overlong forms and surrogates
+        uint8_t low = 0x80, high = 0xBF;
+        if (lead >= 0xC2 && lead <= 0xDF) {
+            length = 2;
+        } else if (lead >= 0xE0 && lead <= 0xEF) {
+            length = 3;
+            if (lead == 0xE0) {
+                low = 0xA0;
+            } else if (lead == 0xED) {
+                high = 0x9F;
+            }
+        } else if (lead >= 0xF0 && lead <= 0xF4) {
+            length = 4;
+            if (lead == 0xF0) {
+                low = 0x90;
+            } else if (lead == 0xF4) {
+                high = 0x8F;
+            }
+        } else {
+            return fail("invalid utf-8");
+        }
+        if (left < length || s[1] < low || s[1] > high) {
+            return fail("invalid utf-8");
+        }
+        for (size_t i = 2; i < length; i++) {
+            if ((s[i] & 0xC0) != 0x80) {
+                return fail("invalid utf-8");
+            }
+        }
+        p += length;
+        return true;
+    }
+
+    bool readHex(uint32_t& value) {
+        if (end - p < 4) {
+            return fail("invalid \\u escape");
+        }
+        value = 0;
+        for (size_t i = 0; i < 4; i++) {
+            char c = p[i];
+            value <<= 4;
+            if (c >= '0' && c <= '9') {
+                value |= c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                value |= c - 'a' + 10;
+            } else if (c >= 'A' && c <= 'F') {
+                value |= c - 'A' + 10;
+            } else {
+                return fail("invalid \\u escape");
+            }
         }
+        p += 4;
+        return true;
+    }
+
+    bool parseEscape() {
+        // p is past the backslash
+        if (p >= end) {
+            return fail("unexpected end of string");
+        }
+        char c = *p++;
+        switch (c) {
+            case '"': scratch += '"'; return true;
+            case '\\': scratch += '\\'; return true;
+            case '/': scratch += '/'; return true;
+            case 'b': scratch += '\b'; return true;
+            case 'f': scratch += '\f'; return true;
+            case 'n': scratch += '\n'; return true;
+            case 'r': scratch += '\r'; return true;
+            case 't': scratch += '\t'; return true;
+            case 'u': break;
+            default: return fail("invalid escape");
+        }
+        uint32_t code;
+        if (!readHex(code)) {
+            return false;
+        }
+        if (code >= 0xDC00 && code <= 0xDFFF) {
+            return fail("unpaired surrogate");
+        } else if (code >= 0xD800 && code <= 0xDBFF) {
+            // has to be followed by the low half
+            uint32_t low;
+            if (end - p < 2 || p[0] != '\\' || p[1] != 'u') {
+                return fail("unpaired surrogate");
+            }
+            p += 2;
+            if (!readHex(low)) {
+                return false;
+            }
+            if (low < 0xDC00 || low > 0xDFFF) {
+                return fail("unpaired surrogate");
+            }
+            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+        }
+        // encode as utf-8
+        if (code < 0x80) {
+            scratch += (char)code;
+        } else if (code < 0x800) {
+            scratch += (char)(0xC0 | (code >> 6));
+            scratch += (char)(0x80 | (code & 0x3F));
+        } else if (code < 0x10000) {
+            scratch += (char)(0xE0 | (code >> 12));
+            scratch += (char)(0x80 | ((code >> 6) & 0x3F));
+            scratch += (char)(0x80 | (code & 0x3F));
+        } else {
+            scratch += (char)(0xF0 | (code >> 18));
+            scratch += (char)(0x80 | ((code >> 12) & 0x3F));
+            scratch += (char)(0x80 | ((code >> 6) & 0x3F));
+            scratch += (char)(0x80 | (code & 0x3F));
+        }
+        return true;
+    }
+
+    // `str` points into the input if there were no escapes, otherwise into the scratch buffer
+    bool parseString(std::string_view& str) {
+        // p is at the opening quote
+        if (structural && next + 1 < structuralCount && begin + structural[next] == p) {
+            // the next structural byte is the closing quote, stage 1 already checked the contents
+            const char* close = begin + structural[next + 1];
+            if (!std::memchr(p + 1, '\\', close - p - 1)) {
+                str = std::string_view(p + 1, close - p - 1);
+                p = close + 1;
+                next += 2;
+                return true;
+            }
+        }
+        p++;
+        const char* start = p;
+        bool escaped = false;
         while (true) {
-            is.get(c);
+            const char* run = p;
+            p = conScanString(p, end);
+            if (escaped) {
+                scratch.append(run, p - run);
+            }
+            if (p >= end) {
+                return fail("unexpected end of string");
+            }
+            uint8_t c = *p;
             if (c == '"') {
-                break;
+                str = escaped ? std::string_view(scratch) : std::string_view(start, p - start);
+                p++;
+                return true;
+            } else if (c == '\\') {
+                if (!escaped) {
+                    scratch.assign(start, p - start);
+                    escaped = true;
+                }
+                p++;
+                if (!parseEscape()) {
+                    return false;
+                }
+            } else if (c < 0x20) {
+                return fail("control character in string");
+            } else {
+                const char* sequence = p;
+                if (!skipUtf8()) {
+                    return false;
+                }
+                if (escaped) {
+                    scratch.append(sequence, p - sequence);
+                }
             }
-            str += c;
-        }
-        value = ConValue(str);
-    } else if (c == '[') {
-        ConArray arr;
-        eliminateWhitespace(is);
-        is >> arr;
-        value = ConValue(&arr);
-    } else if (c == '{') {
-        ConObject obj;
-        eliminateWhitespace(is);
-        is >> obj;
-        value = ConValue(&obj);
-    } else {
+        }
+    }
+
+    bool parseNumber(ConValue& value) {
+        bool floating;
+        int64_t integer;
         double d;
-        eliminateWhitespace(is);
-        is >> d;
-        if (d == (int64_t)d) {
-            value = ConValue((int64_t)d);
-        } else {
-            value = ConValue(d);
+        if (!parseNumber(floating, integer, d)) {
+            return false;
+        }
+        value = floating ? ConValue(d) : ConValue(integer);
+        return true;
+    }
+
+    // either `integer` or `d` is set, depending on `floating`
+    bool parseNumber(bool& floating, int64_t& integer, double& d) {
+        // check the json grammar first, from_chars accepts things json doesn't (and the other way around)
+        const char* start = p;
+        const char* s = p;
+        auto digits = [&]() {
+            const char* first = s;
+            while (s < end && *s >= '0' && *s <= '9') {
+                s++;
+            }
+            return s != first;
+        };
+        if (s < end && *s == '-') {
+            s++;
+        }
+        if (s < end && *s == '0') {
+            s++;
+        } else if (!digits()) {
+            return fail("invalid value");
+        }
+        // only numbers with a fraction or an exponent are floats, everything else is an exact integer
+        floating = false;
+        if (s < end && *s == '.') {
+            s++;
+            floating = true;
+            if (!digits()) {
+                return fail("invalid number");
+            }
+        }
+        if (s < end && (*s == 'e' || *s == 'E')) {
+            s++;
+            floating = true;
+            if (s < end && (*s == '+' || *s == '-')) {
+                s++;
+            }
+            if (!digits()) {
+                return fail("invalid number");
+            }
+        }
+        p = s;
+        if (!delimited()) {
+            return fail("invalid number");
+        }
+        if (!floating) {
+            auto [last, ec] = std::from_chars(start, s, integer);
+            if (ec == std::errc() && last == s) {
+                return true;
+            }
+            // too big for int64, the closest double is all we can do
+            floating = true;
+        }
+        auto [last, ec] = std::from_chars(start, s, d);
+        if (ec == std::errc::result_out_of_range) {
+            // from_chars leaves d alone here, strtod gives infinity or zero (rare enough for the copy)
+            d = std::strtod(std::string(start, s).c_str(), nullptr);
+        } else if (last != s || ec != std::errc()) {
+            p = start;
+            return fail("invalid number");
         }
+        return true;
+    }
+};
+
+// reads a json value from `json`, allocating everything from `resource`
+// returns how many bytes were used (including trailing whitespace), or 0 if it isn't valid json
+size_t readJson(std::string_view json, ConValue& value, std::pmr::memory_resource* resource=std::pmr::get_default_resource()) {
+    // without simd, building the index costs more than it saves
+    ConJsonIndex index;
+    bool indexed = conSimdSupport() != ConSimd::None && index.build(json);
+    ConJsonParser parser(json, indexed ? &index : nullptr);
+    if (!parser.parse(value, resource)) {
+        ConLog() << "Failed to read json: " << parser.error << " at offset " << parser.offset();
+        return 0;
     }
-    if (is.fail()) {
-        std::cout << "Failed to read value?" << std::endl;
-        std::cout << "c: " << c << std::endl;
-        std::cout << "valtype: " << (int)value.type << std::endl;
+    parser.skipWhitespace();
+    return parser.offset();
+}
 
+// streams are read into memory first and parsed from there,
+// seekable streams are left right after the value, others are used up
+template<typename F>
+std::istream& conReadJson(std::istream& is, F parse) {
+    std::streampos start = is.tellg();
+    std::string buffer;
+    if (start != std::streampos(-1) && is.seekg(0, std::ios::end)) {
+        std::streampos last = is.tellg();
+        is.seekg(start);
+        buffer.resize(last - start);
+        is.read(buffer.data(), buffer.size());
+        buffer.resize(is.gcount());
+    } else {
+        is.clear();
+        std::ostringstream contents;
+        contents << is.rdbuf();
+        buffer = std::move(contents).str();
+    }
+    ConJsonIndex index;
+    bool indexed = conSimdSupport() != ConSimd::None && index.build(buffer);
+    ConJsonParser parser(buffer, indexed ? &index : nullptr);
+    if (!parse(parser)) {
+        ConLog() << "Failed to read json: " << parser.error << " at offset " << parser.offset();
+        is.setstate(std::ios::failbit);
+        return is;
+    }
+    parser.skipWhitespace();
+    if (start != std::streampos(-1)) {
+        is.clear();
+        is.seekg(start + (std::streamoff)parser.offset());
+    }
+    if (parser.offset() == buffer.size()) {
+        is.setstate(std::ios::eofbit);
     }
     return is;
-}
\ No newline at end of file
+}
+
+// reads a json value, allocating everything from `resource`
+std::istream& readJson(std::istream& is, ConValue& value, std::pmr::memory_resource* resource) {
+    return conReadJson(is, [&](ConJsonParser& parser) { return parser.parse(value, resource); });
+}
+
+std::istream& operator>>(std::istream& is, ConArray& arr) {
+    return conReadJson(is, [&](ConJsonParser& parser) { return parser.parse(arr); });
+}
+
+std::istream& operator>>(std::istream& is, ConObject& obj) {
+    return conReadJson(is, [&](ConJsonParser& parser) { return parser.parse(obj); });
+}
+
+std::istream& operator>>(std::istream& is, ConValue& value) {
+    return readJson(is, value, std::pmr::get_default_resource());
+}
+
+ConValue& ConArena::readJson(std::istream& stream) {
+    ConValue& value = create();
+    ::readJson(stream, value, &resource);
+    return value;
+}
+
+ConValue& ConArena::readJson(std::string_view json) {
+    ConValue& value = create();
+    ::readJson(json, value, &resource);
+    return value;
+}
@@ -0,0 +1,131 @@
+/**
+ * CON frozen documents
+ * decoded documents that can't be changed anymore, so any number of threads can read them at the same time
+ * without locks or copies of their own, and snapshots that swap in a new version of one (e.g. after the file
+ * was changed) while the old version is still being read, in the style of read-copy-update
+ */
+
+#pragma once
+
+#include "confile.h"
+
+#include <memory>
+
+// an immutable decoded document, shared as a std::shared_ptr<const ConFrozen>
+// thread safety: it only hands out const values, and const access to a value (find, at, iterating, reading fields)
+// never changes anything, so any number of threads can read it at the same time for as long as they hold it
+struct ConFrozen {
+    // takes over a tree, it must not share nodes (see conShare) with values that are still changed elsewhere
+    ConFrozen(ConValue value) : owned(std::move(value)) {}
+    ConFrozen(const ConFrozen&) = delete;
+    ConFrozen& operator=(const ConFrozen&) = delete;
+
+    // reads a document (see ConValue::read), nullptr if it couldn't be read
+    // everything decoded is allocated from memory of the frozen document and freed at once with it,
+    // instead of value by value, so letting go of a large version stays cheap for whichever thread does it
+    // references to shared subtrees (see CON_FLAG_SHARED) hold the subtree itself instead of a copy of it
+    static std::shared_ptr<const ConFrozen> read(std::istream& stream, unsigned threads=1) {
+        std::shared_ptr<ConFrozen> frozen(new ConFrozen(threads));
+        ConValue& value = *std::pmr::polymorphic_allocator<ConValue>(frozen->resource.get()).new_object<ConValue>();
+        value.read(stream, frozen->resource.get(), threads, true);
+        if (!stream) {
+            return nullptr;
+        }
+        frozen->value = &value;
+        return frozen;
+    }
+
+    static std::shared_ptr<const ConFrozen> open(const std::string& path, unsigned threads=1) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            ConLog() << "Failed to open " << path;
+            return nullptr;
+        }
+        return read(file, threads);
+    }
+
+    const ConValue& root() const {
+        return *value;
+    }
+
+    // see ConValue::find and ConValue::at, none of them insert anything
+    const ConValue* find(std::string_view key) const {
+        return value->find(key);
+    }
+
+    const ConValue& at(std::string_view key) const {
+        return value->at(key);
+    }
+
+    const ConValue& at(size_t index) const {
+        return value->at(index);
+    }
+
+    const ConValue& operator[](std::string_view key) const {
+        return at(key);
+    }
+
+    const ConValue& operator[](size_t index) const {
+        return at(index);
+    }
+
+private:
+    // decoded documents live in it, it is never freed value by value (declared first so it goes last)
+    std::unique_ptr<std::pmr::memory_resource> resource;
+    ConValue owned;
+    const ConValue* value = &owned;
+
+    // threaded reads allocate from several threads at once, which a monotonic buffer can't do
+    ConFrozen(unsigned threads) {
+        if (threads == 1) {
+            resource = std::make_unique<std::pmr::monotonic_buffer_resource>(64 * 1024);
+        } else {
+            resource = std::make_unique<std::pmr::synchronized_pool_resource>();
+        }
+    }
+};
+
+// the current version of a frozen document, which can be replaced while other threads are reading it
+// readers get() the current version and keep it for as long as they need to see one consistent document,
+// replacing it doesn't wait for them, the old version is freed by whoever lets go of it last
+// every member can be called from any thread at the same time
+struct ConSnapshot {
+    ConSnapshot(std::shared_ptr<const ConFrozen> frozen=nullptr) : current(std::move(frozen)) {}
+    ConSnapshot(const ConSnapshot&) = delete;
+    ConSnapshot& operator=(const ConSnapshot&) = delete;
+
+    // nullptr if there is no version yet
+    std::shared_ptr<const ConFrozen> get() const {
+#ifdef __cpp_lib_atomic_shared_ptr
+        return current.load(std::memory_order_acquire);
+#else
+        return std::atomic_load_explicit(&current, std::memory_order_acquire);
+#endif
+    }
+
+    // makes `frozen` the current version and returns the one before it
+    std::shared_ptr<const ConFrozen> swap(std::shared_ptr<const ConFrozen> frozen) {
+#ifdef __cpp_lib_atomic_shared_ptr
+        return current.exchange(std::move(frozen), std::memory_order_acq_rel);
+#else
+        return std::atomic_exchange_explicit(&current, std::move(frozen), std::memory_order_acq_rel);
+#endif
+    }
+
+    // reads the file again and makes it the current version, false if it couldn't be read (the current version stays)
+    bool reload(const std::string& path, unsigned threads=1) {
+        std::shared_ptr<const ConFrozen> frozen = ConFrozen::open(path, threads);
+        if (!frozen) {
+            return false;
+        }
+        swap(std::move(frozen));
+        return true;
+    }
+
+private:
+#ifdef __cpp_lib_atomic_shared_ptr
+    std::atomic<std::shared_ptr<const ConFrozen>> current;
+#else
+    std::shared_ptr<const ConFrozen> current;
+#endif
+};
@@ -0,0 +1,378 @@
+/**
+ * CON patches
+ * replacing one value of encoded con data without decoding and encoding the whole document again
+ * a value whose encoding keeps its size is overwritten in place, otherwise only the containers
+ * on the way to it are touched: uncompressed ones get their byte size and offsets adjusted,
+ * compressed ones (and blocks) are inflated, spliced and compressed again on their own,
+ * everything after the value is moved as it is
+ */
+
+#pragma once
+
+#include "conview.h"
+
+#include <filesystem>
+
+// the changes to one buffer (the document or an inflated payload), offsets are relative to its start
+struct ConEdit {
+    // fixed width sizes and offsets in front of the splice that change with it
+    std::vector<std::pair<size_t, uint64_t>> overwrites;
+    // [from, to) is replaced with bytes
+    size_t from = 0;
+    size_t to = 0;
+    std::vector<uint8_t> bytes;
+
+    int64_t delta() const {
+        return (int64_t)bytes.size() - (int64_t)(to - from);
+    }
+
+    bool inPlace() const {
+        return delta() == 0;
+    }
+
+    void apply(std::vector<uint8_t>& buffer) const {
+        for (auto& [at, value] : overwrites) {
+            memcpy(buffer.data() + at, &value, sizeof(uint64_t));
+        }
+        if (inPlace()) {
+            memcpy(buffer.data() + from, bytes.data(), bytes.size());
+        } else {
+            buffer.erase(buffer.begin() + from, buffer.begin() + to);
+            buffer.insert(buffer.begin() + from, bytes.begin(), bytes.end());
+        }
+    }
+};
+
+// works out the edit that puts a value at a path, with the view internals
+struct ConPatcher {
+    const ConValue& value;
+    const ConWriteOptions& options;
+
+    // the edit of the buffer starting at `base` that replaces the value `node` is applied to, `view` lives in that buffer
+    bool edit(const ConView& view, const ConSelection& node, uint64_t level, const uint8_t* base, ConEdit& edit) const {
+        const uint8_t* end = view.skip(view.pos, view.end);
+        if (!end) {
+            return false;
+        }
+        if (node.whole) {
+            edit.from = view.pos - base;
+            edit.to = end - base;
+            ConValue copy = value;
+            return encode(copy, level, options, view, edit.bytes);
+        }
+        ConView child;
+        const ConSelection* next = nullptr;
+        if (!node.keys.empty() && view.type() == ConType::Object) {
+            child = view[node.keys.begin()->first];
+            next = &node.keys.begin()->second;
+        } else if (!node.indices.empty() && view.type() == ConType::Array) {
+            child = view[node.indices.begin()->first];
+            next = &node.indices.begin()->second;
+        }
+        if (!child) {
+            ConLog() << "Path not found";
+            return false;
+        } else if (shared(child)) {
+            // the edit would change every occurrence of it
+            ConLog() << "Values inside of shared subtrees (see CON_FLAG_SHARED) can't be patched";
+            return false;
+        }
+        ConView::Blob blob;
+        ConView::Entries entries;
+        if (!view.readBlob(blob) || !view.entries(entries)) {
+            return false;
+        }
+        const ConFormat& format = view.format();
+        if (blob.layout == CON_COLUMNAR || blob.layout == CON_PACKED) {
+            return reencode(view, node, level, blob.layout, base, edit);
+        }
+        if (blob.layout == CON_BLOCKED) {
+            // only the block holding the element is spliced
+            uint64_t index = node.indices.begin()->first;
+            size_t k = 0;
+            while (k + 1 < entries.blockCount && entries.blockStart(k + 1) <= index) {
+                k++;
+            }
+            ConView::Entries block;
+            if (!view.block(entries, k, block)) {
+                return false;
+            }
+            ConEdit inner;
+            if (!this->edit(child, *next, level + 1, block.first, inner)) {
+                return false;
+            }
+            std::vector<uint8_t> data(block.first, block.end);
+            inner.apply(data);
+            uint64_t offset;
+            memcpy(&offset, entries.blocks + 2 * k * sizeof(uint64_t), sizeof(uint64_t));
+            const uint8_t* p = entries.first + offset;
+            uint8_t compressed = *p++;
+            uint64_t size;
+            uint64_t rawSize = 0;
+            if (!view.readSize(p, entries.end, size) || (compressed && !view.readSize(p, entries.end, rawSize))) {
+                return false;
+            }
+            edit.from = entries.first + offset - base;
+            edit.to = p + size - base;
+            if (!header(format, nullptr, compressed, data, edit.bytes)) {
+                return false;
+            }
+            adjust(view.pos + 2, edit.delta(), base, edit);
+            for (size_t j = k + 1; j < entries.blockCount; j++) {
+                adjust(entries.blocks + 2 * j * sizeof(uint64_t), edit.delta(), base, edit);
+            }
+            return true;
+        }
+        uint8_t compressed = view.pos[1];
+        if (!compressed) {
+            // the child is in the same buffer
+            if (!this->edit(child, *next, level + 1, base, edit)) {
+                return false;
+            }
+            if (format.version >= 1) {
+                // always fixed width, see CON_FLAG_COMPACT
+                adjust(view.pos + 2, edit.delta(), base, edit);
+            }
+            adjustTable(entries, child.pos, edit.delta(), base, edit);
+            return true;
+        }
+        // the payload is inflated, spliced and compressed again
+        ConEdit inner;
+        if (!this->edit(child, *next, level + 1, blob.begin, inner)) {
+            return false;
+        }
+        adjustTable(entries, child.pos, inner.delta(), blob.begin, inner);
+        std::vector<uint8_t> data(blob.begin, blob.end);
+        inner.apply(data);
+        edit.from = view.pos - base;
+        edit.to = end - base;
+        return header(format, view.pos, compressed, data, edit.bytes);
+    }
+
+    // whether a view was reached through a reference, i.e. it lives in the shared table
+    static bool shared(const ConView& view) {
+        const ConFormat& format = view.format();
+        if (format.shared.empty()) {
+            return false;
+        }
+        size_t size;
+        const uint8_t* first = format.sharedValue(0, size);
+        const uint8_t* last = format.sharedValue(format.shared.size() - 1, size) + size;
+        return view.pos >= first && view.pos < last;
+    }
+
+    // adds `delta` to the fixed width size/offset at `p`
+    static void adjust(const uint8_t* p, int64_t delta, const uint8_t* base, ConEdit& edit) {
+        if (delta == 0) {
+            return;
+        }
+        uint64_t value;
+        memcpy(&value, p, sizeof(uint64_t));
+        edit.overwrites.emplace_back(p - base, value + delta);
+    }
+
+    // moves the offsets of the entries after `child`
+    static void adjustTable(const ConView::Entries& entries, const uint8_t* child, int64_t delta, const uint8_t* base, ConEdit& edit) {
+        for (uint64_t i = 0; entries.table && i < entries.count; i++) {
+            const uint8_t* slot = entries.table + (entries.index ? 2 * i + 1 : i) * sizeof(uint64_t);
+            uint64_t offset;
+            memcpy(&offset, slot, sizeof(uint64_t));
+            if (entries.first + offset > child) {
+                adjust(slot, delta, base, edit);
+            }
+        }
+    }
+
+    // the type byte (if there is one), codec id, sizes and the compressed data of a container/block
+    static bool header(const ConFormat& format, const uint8_t* type, uint8_t compressed, const std::vector<uint8_t>& data, std::vector<uint8_t>& bytes) {
+        ConWriter writer;
+        writer.format.version = format.version;
+        writer.format.flags = format.flags;
+        if (type) {
+            writer.put(*type);
+        }
+        writer.put(compressed);
+        if (!compressed) {
+            writer.writeSize(data.size());
+            writer.write(data.data(), data.size());
+            bytes = std::move(writer.buffer);
+            return true;
+        }
+        const ConCodec* codec = conCodec((ConCodecId)compressed);
+        if (!codec) {
+            ConLog() << "Unsupported codec: " << (int)compressed;
+            return false;
+        }
+        std::vector<uint8_t> packed = codec->compress(data.data(), data.size(), CON_LEVEL_DEFAULT, format.dictionary.get());
+        if (packed.empty()) {
+            return false;
+        }
+        writer.writeSize(packed.size());
+        if (format.version >= 1) {
+            writer.writeSize(data.size());
+        }
+        writer.write(packed.data(), packed.size());
+        bytes = std::move(writer.buffer);
+        return true;
+    }
+
+    // columnar and packed arrays are decoded, changed and encoded again like they were stored
+    bool reencode(const ConView& view, const ConSelection& node, uint64_t level, uint8_t layout, const uint8_t* base, ConEdit& edit) const {
+        ConValue array = view.decode();
+        ConValue* target = &array;
+        for (const ConSelection* step = &node; !step->whole;) {
+            if (!step->keys.empty() && target->type == ConType::Object) {
+                auto it = target->object->values.find(step->keys.begin()->first);
+                if (it == target->object->values.end()) {
+                    return false;
+                }
+                target = &it->second;
+                step = &step->keys.begin()->second;
+            } else if (!step->indices.empty() && target->type == ConType::Array && step->indices.begin()->first < target->array->values.size()) {
+                target = &target->array->values[step->indices.begin()->first];
+                step = &step->indices.begin()->second;
+            } else {
+                ConLog() << "Path not found";
+                return false;
+            }
+        }
+        *target = value;
+        // the columns are compressed if any of them was, nothing inside of them is
+        std::vector<ConColumnLayout::Column> columns;
+        ConColumnLayout fields;
+        ConView::Entries entries;
+        ConColumnLayout::Column stored;
+        if (layout == CON_COLUMNAR && view.layout(fields)) {
+            columns = fields.columns;
+        } else if (layout == CON_PACKED && view.entries(entries)) {
+            const uint8_t* p = entries.packed;
+            if (ConColumnLayout::readColumn(view.format(), p, entries.end, stored)) {
+                columns.push_back(stored);
+            }
+        }
+        ConWriteOptions rewrite = options;
+        rewrite.columnar = layout == CON_COLUMNAR;
+        rewrite.packed = layout == CON_PACKED;
+        rewrite.delta = false;
+        rewrite.codec = ConCodecId::None;
+        for (const ConColumnLayout::Column& column : columns) {
+            rewrite.delta |= column.kind == CON_COLUMN_DELTA;
+            if (column.codec) {
+                rewrite.codec = (ConCodecId)column.codec;
+                rewrite.threshold = 0;
+                rewrite.minDepth = level;
+                rewrite.maxDepth = level;
+            }
+        }
+        edit.from = view.pos - base;
+        edit.to = view.skip(view.pos, view.end) - base;
+        return encode(array, level, rewrite, view, edit.bytes);
+    }
+
+    // encodes a value for the document `view` is in
+    static bool encode(ConValue& value, uint64_t level, ConWriteOptions options, const ConView& view, std::vector<uint8_t>& bytes) {
+        const ConFormat& format = view.format();
+        options.version = format.version;
+        ConWriter writer(options);
+        writer.format.version = format.version;
+        writer.format.flags = format.flags;
+        if (format.has(CON_FLAG_KEY_DICTIONARY)) {
+            if (!known(value, format.keys)) {
+                ConLog() << "Keys that aren't in the key dictionary need the whole document to be written again";
+                return false;
+            }
+            writer.parent = &view.source->keys();
+        }
+        value.write(writer, level);
+        bytes = std::move(writer.buffer);
+        return true;
+    }
+
+    // whether every key in `value` is in the key dictionary
+    static bool known(const ConValue& value, const std::vector<std::string>& keys) {
+        if (value.type == ConType::Array) {
+            return std::all_of(value.array->values.begin(), value.array->values.end(), [&](const ConValue& element) { return known(element, keys); });
+        } else if (value.type != ConType::Object) {
+            return true;
+        }
+        for (auto& [key, child] : value.object->values) {
+            if (!std::binary_search(keys.begin(), keys.end(), std::string_view(key)) || !known(child, keys)) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// the edit of the whole document that puts `value` at `path` (see ConSelection::add, without wildcards)
+// `options` are used for encoding the new value, the format is always the one of the document
+bool conPlanPatch(const ConView& root, std::string_view path, const ConValue& value, const ConWriteOptions& options, ConEdit& edit) {
+    ConSelection selection;
+    if (!root || !selection.add(path)) {
+        return false;
+    }
+    for (const ConSelection* node = &selection; !node->whole;) {
+        if (node->elements || node->entries || node->keys.size() + node->indices.size() != 1) {
+            ConLog() << "Patch paths can't have wildcards: " << path;
+            return false;
+        }
+        node = node->keys.empty() ? &node->indices.begin()->second : &node->keys.begin()->second;
+    }
+    ConPatcher patcher{value, options};
+    return patcher.edit(root, selection, 0, root.source->data, edit);
+}
+
+// replaces the value at `path` in an encoded document, false (with the document unchanged) if it isn't there
+// objects in the new value can only have keys that are in the key dictionary already (if there is one)
+bool conPatch(std::vector<uint8_t>& document, std::string_view path, const ConValue& value, const ConWriteOptions& options={}) {
+    ConEdit edit;
+    if (!conPlanPatch(ConView::wrap(document.data(), document.size()), path, value, options, edit)) {
+        return false;
+    }
+    edit.apply(document);
+    return true;
+}
+
+// like conPatch, for a .con file: only the changed bytes are written if the value keeps its size,
+// otherwise everything after it is moved (and the file truncated if it got smaller)
+bool conPatchFile(const std::string& file, std::string_view path, const ConValue& value, const ConWriteOptions& options={}) {
+    ConEdit edit;
+    if (!conPlanPatch(ConView::open(file), path, value, options, edit)) {
+        return false;
+    }
+    std::fstream stream(file, std::ios::in | std::ios::out | std::ios::binary);
+    if (!stream) {
+        ConLog() << "Failed to open " << file;
+        return false;
+    }
+    for (auto& [at, size] : edit.overwrites) {
+        stream.seekp(at);
+        stream.write((const char*)&size, sizeof(uint64_t));
+    }
+    std::vector<char> rest;
+    if (!edit.inPlace()) {
+        stream.seekg(0, std::ios::end);
+        size_t fileSize = stream.tellg();
+        rest.resize(fileSize - edit.to);
+        stream.seekg(edit.to);
+        stream.read(rest.data(), rest.size());
+    }
+    stream.seekp(edit.from);
+    stream.write((const char*)edit.bytes.data(), edit.bytes.size());
+    stream.write(rest.data(), rest.size());
+    size_t newSize = stream.tellp();
+    stream.close();
+    if (!stream) {
+        ConLog() << "Failed to write " << file;
+        return false;
+    }
+    if (edit.delta() < 0) {
+        std::error_code error;
+        std::filesystem::resize_file(file, newSize, error);
+        if (error) {
+            ConLog() << "Failed to truncate " << file << ": " << error.message();
+            return false;
+        }
+    }
+    return true;
+}
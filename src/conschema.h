@@ -0,0 +1,692 @@
+/**
+ * CON schemas
+ * reading and writing C++ structs directly, without a ConValue tree in between
+ * a struct lists its fields once, at namespace scope:
+ *
+ *     struct User { std::string name; int64_t age; std::vector<std::string> tags; };
+ *     CON_SCHEMA(User, name, age, tags)
+ *
+ *     conWrite(out, user);
+ *     conRead(ConView::open("user.con"), user);
+ *
+ * the encoders and decoders are put together at compile time, every value is checked against
+ * the type of its field while it is read, fields are found without building a map
+ * members can be bools, integers, floats, std::string, std::vector, std::optional,
+ * std::map<std::string, T>, ConValue (anything goes) and other structs with a schema
+ */
+
+#pragma once
+
+#include "conview.h"
+
+#include <concepts>
+#include <string_view>
+#include <tuple>
+#include <utility>
+
+// a member of a struct and the key it is stored with
+template<typename Class, typename Member>
+struct ConSchemaField {
+    std::string_view key;
+    Member Class::* member;
+};
+
+// the fields of a struct, see CON_SCHEMA
+template<typename T>
+struct ConSchema;
+
+#define CON_SCHEMA_FIELD(type, field) ConSchemaField<type, decltype(type::field)>{#field, &type::field}
+
+// calls macro(type, field) for every field, separated by commas
+#define CON_SCHEMA_PARENS ()
+#define CON_SCHEMA_EXPAND(...) CON_SCHEMA_EXPAND3(CON_SCHEMA_EXPAND3(CON_SCHEMA_EXPAND3(CON_SCHEMA_EXPAND3(__VA_ARGS__))))
+#define CON_SCHEMA_EXPAND3(...) CON_SCHEMA_EXPAND2(CON_SCHEMA_EXPAND2(CON_SCHEMA_EXPAND2(CON_SCHEMA_EXPAND2(__VA_ARGS__))))
+#define CON_SCHEMA_EXPAND2(...) CON_SCHEMA_EXPAND1(CON_SCHEMA_EXPAND1(CON_SCHEMA_EXPAND1(CON_SCHEMA_EXPAND1(__VA_ARGS__))))
+#define CON_SCHEMA_EXPAND1(...) __VA_ARGS__
+#define CON_SCHEMA_FOR_EACH(macro, type, ...) __VA_OPT__(CON_SCHEMA_EXPAND(CON_SCHEMA_FOR_EACH_NEXT(macro, type, __VA_ARGS__)))
+#define CON_SCHEMA_FOR_EACH_NEXT(macro, type, field, ...) macro(type, field) __VA_OPT__(, CON_SCHEMA_FOR_EACH_AGAIN CON_SCHEMA_PARENS (macro, type, __VA_ARGS__))
+#define CON_SCHEMA_FOR_EACH_AGAIN() CON_SCHEMA_FOR_EACH_NEXT
+
+// stores `type` as an object with the listed members as its entries, keyed by their names
+// has to be used at namespace scope, outside of any namespace (qualify the type instead)
+#define CON_SCHEMA(type, ...) \
+    template<> \
+    struct ConSchema<type> { \
+        constexpr static auto fields = std::make_tuple(CON_SCHEMA_FOR_EACH(CON_SCHEMA_FIELD, type, __VA_ARGS__)); \
+    };
+
+template<typename T>
+concept ConSchematic = requires { ConSchema<T>::fields; };
+
+// how values of a type are read and written, specialized for every supported type
+//   decode(view, value) reads a value, false (and a message) if it has the wrong type
+//   decodeCell(column, row, value) reads a value out of a typed column (see ConColumn)
+//   encode(writer, value, level) writes it the way ConValue::write writes the equivalent value
+//   collectKeys(value, keys) adds the object keys it is written with (see CON_FLAG_KEY_DICTIONARY)
+template<typename T>
+struct ConSchemaType {
+    static_assert(!sizeof(T), "the type isn't supported, structs need a CON_SCHEMA");
+};
+
+const char* conSchemaTypeName(ConType type) {
+    switch (type) {
+        case ConType::Null: return "null";
+        case ConType::Boolean: return "a boolean";
+        case ConType::Integer: return "an integer";
+        case ConType::Float: return "a float";
+        case ConType::String: return "a string";
+        case ConType::Array: return "an array";
+        case ConType::Object: return "an object";
+        default: return "an invalid value";
+    }
+}
+
+bool conSchemaMismatch(const char* expected, ConType got) {
+    ConLog() << "Expected " << expected << ", got " << conSchemaTypeName(got);
+    return false;
+}
+
+// the type of the values of a typed column, Null for null cells
+ConType conCellType(const ConColumn& column, size_t row) {
+    return column.isNull(row) ? ConType::Null : (ConType)column.kind;
+}
+
+template<typename T>
+bool conDecodeCell(const ConView& container, const ConColumn& column, size_t row, T& value) {
+    if (column.kind != CON_COLUMN_VALUES) {
+        return ConSchemaType<T>::decodeCell(column, row, value);
+    }
+    const uint8_t* encoded = column.value(row);
+    if (!encoded) {
+        ConLog() << "Invalid column";
+        return false;
+    }
+    return ConSchemaType<T>::decode(ConView(container.source, encoded, column.end), value);
+}
+
+// the compressed encoding of a string/array/object payload, empty if it stays uncompressed
+// the same policy as ConValue::write, except that ConWriteOptions::shouldCompress isn't asked (there is no ConValue to pass)
+std::vector<uint8_t> conSchemaCompress(ConWriter& writer, uint64_t level, const uint8_t* data, size_t size) {
+    const static ConValue none;
+    if (!writer.shouldCompress(none, level, data, size)) {
+        return {};
+    }
+    return writer.compress(data, size);
+}
+
+// the codec byte, sizes and payload of an array/object, `payload(writer)` encodes the uncompressed payload
+template<typename Payload>
+void conSchemaWriteContainer(ConWriter& writer, ConType type, uint64_t level, Payload payload) {
+    bool sized = writer.format.version >= 1;
+    bool compressible = writer.compressible(level);
+    writer.put((uint8_t)type);
+    size_t header = writer.reserve(compressible || sized ? 1 + sizeof(uint64_t) : 1);
+    size_t start = writer.size();
+    payload(writer);
+    uint64_t payloadSize = writer.size() - start;
+    std::vector<uint8_t> compressed = conSchemaCompress(writer, level, writer.data(start), payloadSize);
+    if (!compressed.empty()) {
+        writer.truncate(header);
+        writer.put((uint8_t)writer.codec->id);
+        writer.writeSize(compressed.size());
+        if (sized) {
+            writer.writeSize(payloadSize);
+        }
+        writer.write(compressed.data(), compressed.size());
+        return;
+    }
+    if (sized) {
+        writer.patch(header + 1, payloadSize);
+    } else if (compressible) {
+        writer.erase(header + 1, sizeof(uint64_t));
+    }
+    writer.patch(header, (uint8_t)0);
+}
+
+template<>
+struct ConSchemaType<bool> {
+    static bool decode(const ConView& view, bool& value) {
+        if (view.type() != ConType::Boolean) {
+            return conSchemaMismatch("a boolean", view.type());
+        }
+        value = view.asBoolean();
+        return true;
+    }
+
+    static bool decodeCell(const ConColumn& column, size_t row, bool& value) {
+        if (conCellType(column, row) != ConType::Boolean) {
+            return conSchemaMismatch("a boolean", conCellType(column, row));
+        }
+        value = column.boolean(row);
+        return true;
+    }
+
+    static void encode(ConWriter& writer, bool value, uint64_t) {
+        if (writer.format.has(CON_FLAG_COMPACT)) {
+            writer.put(value ? CON_TAG_TRUE : CON_TAG_FALSE);
+            return;
+        }
+        writer.put((uint8_t)ConType::Boolean);
+        writer.write(value);
+    }
+
+    static void collectKeys(bool, std::vector<std::string_view>&) {}
+};
+
+// integers are checked against the range of the member, except for uint64_t: anything above INT64_MAX
+// is stored as the int64_t with the same bits
+template<std::integral T>
+struct ConSchemaType<T> {
+    static bool fits(int64_t value) {
+        return std::is_same_v<T, uint64_t> || std::in_range<T>(value);
+    }
+
+    static bool decode(const ConView& view, T& value) {
+        if (view.type() != ConType::Integer) {
+            return conSchemaMismatch("an integer", view.type());
+        }
+        return set(view.asInteger(), value);
+    }
+
+    static bool decodeCell(const ConColumn& column, size_t row, T& value) {
+        if (conCellType(column, row) != ConType::Integer) {
+            return conSchemaMismatch("an integer", conCellType(column, row));
+        }
+        return set(column.integer(row), value);
+    }
+
+    static bool set(int64_t integer, T& value) {
+        if (!fits(integer)) {
+            ConLog() << "Integer out of range: " << integer;
+            return false;
+        }
+        value = (T)integer;
+        return true;
+    }
+
+    static void encode(ConWriter& writer, T value, uint64_t) {
+        int64_t integer = (int64_t)value;
+        if (!writer.format.has(CON_FLAG_COMPACT)) {
+            writer.put((uint8_t)ConType::Integer);
+            writer.write(integer);
+        } else if (integer >= 0 && integer < 0x80) {
+            writer.put(CON_TAG_SMALL_INTEGER | (uint8_t)integer);
+        } else {
+            writer.put((uint8_t)ConType::Integer);
+            writer.writeVarint(conZigzag(integer));
+        }
+    }
+
+    static void collectKeys(T, std::vector<std::string_view>&) {}
+};
+
+// integers are accepted too, json doesn't tell 1 and 1.0 apart
+template<std::floating_point T>
+struct ConSchemaType<T> {
+    static bool decode(const ConView& view, T& value) {
+        if (view.type() == ConType::Integer) {
+            value = (T)view.asInteger();
+            return true;
+        } else if (view.type() != ConType::Float) {
+            return conSchemaMismatch("a float", view.type());
+        }
+        value = (T)view.asFloat();
+        return true;
+    }
+
+    static bool decodeCell(const ConColumn& column, size_t row, T& value) {
+        ConType type = conCellType(column, row);
+        if (type == ConType::Integer) {
+            value = (T)column.integer(row);
+            return true;
+        } else if (type != ConType::Float) {
+            return conSchemaMismatch("a float", type);
+        }
+        value = (T)column.floating(row);
+        return true;
+    }
+
+    static void encode(ConWriter& writer, T value, uint64_t) {
+        writer.put((uint8_t)ConType::Float);
+        writer.write((double)value);
+    }
+
+    static void collectKeys(T, std::vector<std::string_view>&) {}
+};
+
+template<>
+struct ConSchemaType<std::string> {
+    static bool decode(const ConView& view, std::string& value) {
+        if (view.type() != ConType::String) {
+            return conSchemaMismatch("a string", view.type());
+        }
+        value = view.asString();
+        return true;
+    }
+
+    static bool decodeCell(const ConColumn& column, size_t row, std::string& value) {
+        if (conCellType(column, row) != ConType::String) {
+            return conSchemaMismatch("a string", conCellType(column, row));
+        }
+        value = column.string(row);
+        return true;
+    }
+
+    static void encode(ConWriter& writer, const std::string& value, uint64_t level) {
+        writer.put((uint8_t)ConType::String);
+        std::vector<uint8_t> compressed = conSchemaCompress(writer, level, (const uint8_t*)value.data(), value.size());
+        if (!compressed.empty()) {
+            writer.put((uint8_t)writer.codec->id);
+            writer.writeSize(compressed.size());
+            if (writer.format.version >= 1) {
+                writer.writeSize(value.size());
+            }
+            writer.write(compressed.data(), compressed.size());
+            return;
+        }
+        writer.put(0);
+        writer.writeSize(value.size());
+        writer.write(value.data(), value.size());
+    }
+
+    static void collectKeys(const std::string&, std::vector<std::string_view>&) {}
+};
+
+// null is nullopt
+template<typename T>
+struct ConSchemaType<std::optional<T>> {
+    static bool decode(const ConView& view, std::optional<T>& value) {
+        if (view.type() == ConType::Null) {
+            value.reset();
+            return true;
+        }
+        return ConSchemaType<T>::decode(view, value.emplace());
+    }
+
+    static bool decodeCell(const ConColumn& column, size_t row, std::optional<T>& value) {
+        if (column.isNull(row)) {
+            value.reset();
+            return true;
+        }
+        return ConSchemaType<T>::decodeCell(column, row, value.emplace());
+    }
+
+    static void encode(ConWriter& writer, const std::optional<T>& value, uint64_t level) {
+        if (!value) {
+            writer.put((uint8_t)ConType::Null);
+            return;
+        }
+        ConSchemaType<T>::encode(writer, *value, level);
+    }
+
+    static void collectKeys(const std::optional<T>& value, std::vector<std::string_view>& keys) {
+        if (value) {
+            ConSchemaType<T>::collectKeys(*value, keys);
+        }
+    }
+};
+
+// the offset table of an array/object (see CON_FLAG_OFFSETS, CON_FLAG_KEY_INDEX), filled in while the entries are written
+struct ConSchemaTable {
+    ConWriter& writer;
+    bool index;
+    bool offsets;
+    size_t table;
+    size_t start;
+
+    ConSchemaTable(ConWriter& writer, uint64_t size, bool object) : writer(writer) {
+        writer.writeSize(size);
+        index = object && writer.format.has(CON_FLAG_KEY_INDEX);
+        offsets = index || writer.format.has(CON_FLAG_OFFSETS);
+        table = offsets ? writer.reserve(size * (index ? 2 : 1) * sizeof(uint64_t)) : 0;
+        start = writer.size();
+    }
+
+    // entry i starts here
+    void place(size_t i, std::string_view key={}) {
+        size_t entry = table + i * (index ? 2 : 1) * sizeof(uint64_t);
+        if (index) {
+            writer.patch(entry, conKeyPrefix(key));
+            entry += sizeof(uint64_t);
+        }
+        if (offsets) {
+            writer.patch(entry, (uint64_t)(writer.size() - start));
+        }
+    }
+};
+
+// packed arrays (see CON_PACKED) are read straight out of their column
+template<typename T>
+struct ConSchemaType<std::vector<T>> {
+    static bool decode(const ConView& view, std::vector<T>& values) {
+        if (view.type() != ConType::Array) {
+            return conSchemaMismatch("an array", view.type());
+        }
+        values.clear();
+        if constexpr (ConSchematic<T>) {
+            ConColumnLayout layout;
+            if (view.layout(layout)) {
+                return ConSchemaType<T>::decodeColumns(view, layout, values);
+            }
+        }
+        ConColumn column;
+        if (view.asColumn(column)) {
+            values.resize(column.rows);
+            for (size_t i = 0; i < column.rows; i++) {
+                if (!conDecodeCell(view, column, i, values[i])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        // the count comes straight from the document, see CON_RESERVE_LIMIT
+        values.reserve(std::min<uint64_t>(view.size(), CON_RESERVE_LIMIT));
+        bool result = true;
+        bool complete = view.forEach([&](size_t, const ConView& element) {
+            return result = ConSchemaType<T>::decode(element, values.emplace_back());
+        });
+        if (result && !complete) {
+            ConLog() << "Invalid array";
+        }
+        return result && complete;
+    }
+
+    static bool decodeCell(const ConColumn& column, size_t row, std::vector<T>&) {
+        return conSchemaMismatch("an array", conCellType(column, row));
+    }
+
+    static void encode(ConWriter& writer, const std::vector<T>& values, uint64_t level) {
+        conSchemaWriteContainer(writer, ConType::Array, level, [&](ConWriter& writer) {
+            ConSchemaTable table(writer, values.size(), false);
+            for (size_t i = 0; i < values.size(); i++) {
+                table.place(i);
+                ConSchemaType<T>::encode(writer, values[i], level + 1);
+            }
+        });
+    }
+
+    static void collectKeys(const std::vector<T>& values, std::vector<std::string_view>& keys) {
+        for (const T& value : values) {
+            ConSchemaType<T>::collectKeys(value, keys);
+        }
+    }
+};
+
+// objects with any keys
+template<typename T>
+struct ConSchemaType<std::map<std::string, T>> {
+    static bool decode(const ConView& view, std::map<std::string, T>& values) {
+        if (view.type() != ConType::Object) {
+            return conSchemaMismatch("an object", view.type());
+        }
+        values.clear();
+        bool result = true;
+        bool complete = view.forEach([&](std::string_view key, const ConView& entry) {
+            // entries are sorted, so the hint appends every one of them
+            auto it = values.try_emplace(values.end(), std::string(key));
+            return result = ConSchemaType<T>::decode(entry, it->second);
+        });
+        if (result && !complete) {
+            ConLog() << "Invalid object";
+        }
+        return result && complete;
+    }
+
+    static bool decodeCell(const ConColumn& column, size_t row, std::map<std::string, T>&) {
+        return conSchemaMismatch("an object", conCellType(column, row));
+    }
+
+    static void encode(ConWriter& writer, const std::map<std::string, T>& values, uint64_t level) {
+        conSchemaWriteContainer(writer, ConType::Object, level, [&](ConWriter& writer) {
+            ConSchemaTable table(writer, values.size(), true);
+            size_t i = 0;
+            for (auto& [key, value] : values) {
+                table.place(i++, key);
+                writer.writeKey(key);
+                ConSchemaType<T>::encode(writer, value, level + 1);
+            }
+        });
+    }
+
+    static void collectKeys(const std::map<std::string, T>& values, std::vector<std::string_view>& keys) {
+        for (auto& [key, value] : values) {
+            keys.push_back(key);
+            ConSchemaType<T>::collectKeys(value, keys);
+        }
+    }
+};
+
+// any value, decoded as a tree
+template<>
+struct ConSchemaType<ConValue> {
+    static bool decode(const ConView& view, ConValue& value) {
+        if (!view) {
+            ConLog() << "Invalid value";
+            return false;
+        }
+        value = view.decode();
+        return true;
+    }
+
+    static bool decodeCell(const ConColumn& column, size_t row, ConValue& value) {
+        value = column.cell(row, std::pmr::get_default_resource());
+        return true;
+    }
+
+    static void encode(ConWriter& writer, const ConValue& value, uint64_t level) {
+        // writing may reorder the entries of its objects, so a copy is written
+        ConValue copy = value;
+        copy.write(writer, level);
+    }
+
+    static void collectKeys(const ConValue& value, std::vector<std::string_view>& keys) {
+        if (value.type == ConType::Array) {
+            for (const ConValue& element : value.array->values) {
+                collectKeys(element, keys);
+            }
+        } else if (value.type == ConType::Object) {
+            for (auto& [key, element] : value.object->values) {
+                keys.push_back(key);
+                collectKeys(element, keys);
+            }
+        }
+    }
+};
+
+// the fields in the order of their keys, which is the order objects store their entries in
+template<size_t N>
+constexpr std::array<size_t, N> conSortFields(const std::array<std::string_view, N>& keys) {
+    std::array<size_t, N> order{};
+    for (size_t i = 0; i < N; i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+    return order;
+}
+
+// structs are objects, keys that aren't in the schema are skipped and missing ones leave their member as it is
+template<ConSchematic T>
+struct ConSchemaType<T> {
+    constexpr static auto& fields = ConSchema<T>::fields;
+    constexpr static size_t COUNT = std::tuple_size_v<std::remove_cvref_t<decltype(ConSchema<T>::fields)>>;
+    constexpr static std::array<std::string_view, COUNT> unsorted = []<size_t... I>(std::index_sequence<I...>) {
+        return std::array<std::string_view, COUNT>{std::get<I>(ConSchema<T>::fields).key...};
+    }(std::make_index_sequence<COUNT>());
+    constexpr static std::array<size_t, COUNT> order = conSortFields(unsorted);
+    // the keys in sorted order, keys[i] is the key of field order[i]
+    constexpr static std::array<std::string_view, COUNT> keys = [] {
+        std::array<std::string_view, COUNT> keys{};
+        for (size_t i = 0; i < COUNT; i++) {
+            keys[i] = unsorted[order[i]];
+        }
+        return keys;
+    }();
+    static_assert(std::adjacent_find(keys.begin(), keys.end()) == keys.end(), "a schema can't have the same field twice");
+
+    using Decoder = bool (*)(const ConView& view, T& value);
+    using ColumnDecoder = bool (*)(const ConView& container, const ConColumn& column, size_t row, T& value);
+
+    // decoders[i] reads the member with keys[i]
+    template<size_t I>
+    static bool decodeField(const ConView& view, T& value) {
+        auto& field = std::get<order[I]>(fields);
+        return ConSchemaType<std::remove_cvref_t<decltype(value.*field.member)>>::decode(view, value.*field.member);
+    }
+
+    template<size_t I>
+    static bool decodeFieldCell(const ConView& container, const ConColumn& column, size_t row, T& value) {
+        auto& field = std::get<order[I]>(fields);
+        return conDecodeCell(container, column, row, value.*field.member);
+    }
+
+    constexpr static std::array<Decoder, COUNT> decoders = []<size_t... I>(std::index_sequence<I...>) {
+        return std::array<Decoder, COUNT>{&decodeField<I>...};
+    }(std::make_index_sequence<COUNT>());
+    constexpr static std::array<ColumnDecoder, COUNT> cellDecoders = []<size_t... I>(std::index_sequence<I...>) {
+        return std::array<ColumnDecoder, COUNT>{&decodeFieldCell<I>...};
+    }(std::make_index_sequence<COUNT>());
+
+    // index of the field with `key` in keys, COUNT if there is none
+    // entries come in sorted order too, so the field after the previous one is tried first
+    static size_t find(std::string_view key, size_t next) {
+        if (next < COUNT && keys[next] == key) {
+            return next;
+        }
+        auto it = std::lower_bound(keys.begin(), keys.end(), key);
+        return it != keys.end() && *it == key ? it - keys.begin() : COUNT;
+    }
+
+    static bool decode(const ConView& view, T& value) {
+        if (view.type() != ConType::Object) {
+            return conSchemaMismatch("an object", view.type());
+        }
+        bool result = true;
+        size_t next = 0;
+        bool complete = view.forEach([&](std::string_view key, const ConView& entry) {
+            size_t field = find(key, next);
+            if (field == COUNT) {
+                return true;
+            }
+            next = field + 1;
+            if (!decoders[field](entry, value)) {
+                ConLog() << "Invalid field: " << key;
+                return result = false;
+            }
+            return true;
+        });
+        if (result && !complete) {
+            ConLog() << "Invalid object";
+        }
+        return result && complete;
+    }
+
+    static bool decodeCell(const ConColumn& column, size_t row, T&) {
+        return conSchemaMismatch("an object", conCellType(column, row));
+    }
+
+    // the rows of a columnar array (see CON_COLUMNAR), one field at a time
+    // the columns are loaded before the rows are made, loading checks the row count against their data
+    static bool decodeColumns(const ConView& view, const ConColumnLayout& layout, std::vector<T>& values) {
+        std::array<ConColumn, COUNT> columns;
+        std::array<bool, COUNT> present{};
+        for (size_t field = 0; field < COUNT; field++) {
+            if (layout.find(keys[field]) == layout.keys.size()) {
+                continue;
+            } else if (!view.column(keys[field], columns[field])) {
+                ConLog() << "Invalid column";
+                return false;
+            }
+            present[field] = true;
+        }
+        values.resize(layout.rows);
+        for (size_t field = 0; field < COUNT; field++) {
+            if (!present[field]) {
+                continue;
+            }
+            const ConColumn& column = columns[field];
+            for (size_t row = 0; row < values.size(); row++) {
+                if (!cellDecoders[field](view, column, row, values[row])) {
+                    ConLog() << "Invalid field: " << keys[field];
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    static void encode(ConWriter& writer, const T& value, uint64_t level) {
+        conSchemaWriteContainer(writer, ConType::Object, level, [&](ConWriter& writer) {
+            ConSchemaTable table(writer, COUNT, true);
+            [&]<size_t... I>(std::index_sequence<I...>) {
+                (encodeField<I>(writer, table, value, level), ...);
+            }(std::make_index_sequence<COUNT>());
+        });
+    }
+
+    template<size_t I>
+    static void encodeField(ConWriter& writer, ConSchemaTable& table, const T& value, uint64_t level) {
+        auto& field = std::get<order[I]>(fields);
+        table.place(I, keys[I]);
+        writer.writeKey(keys[I]);
+        ConSchemaType<std::remove_cvref_t<decltype(value.*field.member)>>::encode(writer, value.*field.member, level + 1);
+    }
+
+    static void collectKeys(const T& value, std::vector<std::string_view>& keys) {
+        keys.insert(keys.end(), ConSchemaType::keys.begin(), ConSchemaType::keys.end());
+        std::apply([&](auto&... field) {
+            (ConSchemaType<std::remove_cvref_t<decltype(value.*field.member)>>::collectKeys(value.*field.member, keys), ...);
+        }, fields);
+    }
+};
+
+// reads a value of a document into `value`, false if the data doesn't match its type
+template<typename T>
+bool conRead(const ConView& view, T& value) {
+    if (!view) {
+        ConLog() << "Invalid document";
+        return false;
+    }
+    return ConSchemaType<T>::decode(view, value);
+}
+
+// reads the rest of a stream as a document into `value`, the stream fails if it doesn't match
+template<typename T>
+bool conRead(std::istream& stream, T& value) {
+    std::string data((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    if (!conRead(ConView::wrap(data.data(), data.size()), value)) {
+        stream.setstate(std::ios::failbit);
+        return false;
+    }
+    return true;
+}
+
+// writes `value` like ConValue::write writes the equivalent tree
+// blocks, columns, packed arrays, shared subtrees, threads and the shouldCompress callback need a tree,
+// so they aren't supported here
+template<typename T>
+void conWrite(std::ostream& stream, const T& value, ConWriteOptions options={}) {
+    if (options.blockElements || options.blockBytes || options.columnar || options.packed || options.shared || options.threads != 1 || options.shouldCompress) {
+        ConLog(ConLogLevel::Warning) << "Schema writes don't support blocks, columns, packed arrays, shared subtrees, threads or shouldCompress, ignoring them";
+    }
+    options.blockElements = 0;
+    options.blockBytes = 0;
+    options.columnar = false;
+    options.packed = false;
+    options.shared = false;
+    options.threads = 1;
+    options.shouldCompress = nullptr;
+    ConWriter writer(options);
+    if (writer.format.has(CON_FLAG_KEY_DICTIONARY)) {
+        std::vector<std::string_view> keys;
+        ConSchemaType<T>::collectKeys(value, keys);
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        writer.format.keys.assign(keys.begin(), keys.end());
+        for (size_t i = 0; i < writer.format.keys.size(); i++) {
+            writer.keyIds[writer.format.keys[i]] = i;
+        }
+    }
+    writer.writeHeader();
+    ConSchemaType<T>::encode(writer, value, 0);
+    writer.flush(stream);
+}
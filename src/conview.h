@@ -0,0 +1,1116 @@
+/**
+ * CON views
+ * lazy, zero-copy navigation of encoded con data
+ * a view is just a pointer to an encoded value, looking something up only walks
+ * the values on the way to it, nothing else gets decoded or copied
+ * strings are returned as std::string_views into the mapped file
+ */
+
+#pragma once
+
+#include "confile.h"
+
+#include <memory>
+#include <mutex>
+#include <string_view>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// the bytes views point into, a mapped file or a buffer owned by the caller
+// compressed containers are inflated once on first access and kept here, so views into them stay valid
+struct ConViewSource {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    ConFormat format;
+
+    void* mapping = nullptr;
+    size_t mappingSize = 0;
+    // used instead of a mapping where mmap isn't available
+    std::vector<uint8_t> owned;
+
+    std::mutex mutex;
+    // inflated payloads, keyed by the compressed data they came from
+    std::map<const uint8_t*, std::vector<uint8_t>> inflated;
+    // delta columns expanded to integer columns, keyed by the stored data they came from
+    std::map<const uint8_t*, std::vector<uint8_t>> expanded;
+    // rows of columnar arrays and elements of packed arrays that have been viewed, keyed by the array and the index
+    std::map<std::pair<const uint8_t*, size_t>, std::vector<uint8_t>> rows;
+    // looks up the index of every key in the key dictionary, for encoding rows
+    std::optional<ConWriter> keyWriter;
+
+    ConViewSource() = default;
+    ConViewSource(const ConViewSource&) = delete;
+    ConViewSource& operator=(const ConViewSource&) = delete;
+
+    ~ConViewSource() {
+#ifndef _WIN32
+        if (mapping) {
+            munmap(mapping, mappingSize);
+        }
+#endif
+    }
+
+    bool open(const std::string& path) {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            ConLog() << "Failed to open " << path;
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            ConLog() << "Failed to stat " << path;
+            ::close(fd);
+            return false;
+        }
+        mappingSize = info.st_size;
+        if (mappingSize > 0) {
+            mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                ConLog() << "Failed to map " << path;
+                mapping = nullptr;
+                ::close(fd);
+                return false;
+            }
+        }
+        // the mapping stays valid after the descriptor is closed
+        ::close(fd);
+        data = (const uint8_t*)mapping;
+        size = mappingSize;
+        return true;
+#else
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            ConLog() << "Failed to open " << path;
+            return false;
+        }
+        owned.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        data = owned.data();
+        size = owned.size();
+        return true;
+#endif
+    }
+
+    const ConWriter& keys() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!keyWriter) {
+            keyWriter.emplace();
+            for (size_t i = 0; i < format.keys.size(); i++) {
+                keyWriter->keyIds[format.keys[i]] = i;
+            }
+        }
+        return *keyWriter;
+    }
+
+    // inflates a compressed payload, or returns the copy inflated earlier
+    const std::vector<uint8_t>& inflate(uint8_t codec, const uint8_t* compressed, size_t compressedSize, size_t rawSize) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = inflated.find(compressed);
+        if (it == inflated.end()) {
+            it = inflated.emplace(compressed, conDecompress(codec, compressed, compressedSize, rawSize, format.dictionary.get())).first;
+        }
+        return it->second;
+    }
+
+    // expands a delta column (see CON_COLUMN_DELTA), or returns the copy expanded earlier, empty if it is invalid
+    const std::vector<uint8_t>& expand(const uint8_t* stored, const uint8_t* data, size_t size, uint64_t rows) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = expanded.find(stored);
+        if (it == expanded.end()) {
+            std::vector<uint8_t> column;
+            if (!conExpandDelta(data, size, rows, column)) {
+                column.clear();
+            }
+            it = expanded.emplace(stored, std::move(column)).first;
+        }
+        return it->second;
+    }
+};
+
+struct ConView {
+    std::shared_ptr<ConViewSource> source;
+    // type byte of the value, nullptr if the view is invalid (missing key, index out of range, malformed data)
+    const uint8_t* pos = nullptr;
+    // end of the buffer the value lives in, either the file or an inflated payload
+    const uint8_t* end = nullptr;
+
+    ConView() = default;
+    ConView(std::shared_ptr<ConViewSource> source, const uint8_t* pos, const uint8_t* end) : source(std::move(source)), pos(pos), end(end) {
+        resolve();
+    }
+
+    // maps a .con file, the mapping lives as long as any view into it
+    static ConView open(const std::string& path) {
+        auto source = std::make_shared<ConViewSource>();
+        if (!source->open(path)) {
+            return {};
+        }
+        return root(std::move(source));
+    }
+
+    // views an encoded document in memory, the buffer has to outlive the view
+    static ConView wrap(const void* data, size_t size) {
+        auto source = std::make_shared<ConViewSource>();
+        source->data = (const uint8_t*)data;
+        source->size = size;
+        return root(std::move(source));
+    }
+
+    bool valid() const {
+        return pos != nullptr;
+    }
+
+    explicit operator bool() const {
+        return valid();
+    }
+
+    ConType type() const {
+        return valid() ? conTagType(*pos) : ConType::Null;
+    }
+
+    // number of elements of an array/object, or bytes of a string
+    size_t size() const {
+        if (type() == ConType::String) {
+            return asString().size();
+        }
+        Entries entries;
+        return this->entries(entries) ? entries.count : 0;
+    }
+
+    // element of an array
+    ConView operator[](size_t index) const {
+        Entries entries;
+        if (type() != ConType::Array || !this->entries(entries) || index >= entries.count) {
+            return {};
+        }
+        if (entries.columns) {
+            return row(entries, index);
+        } else if (entries.packed) {
+            return element(entries, index);
+        }
+        if (entries.blocks) {
+            // only the block holding the element is inflated
+            size_t k = 0;
+            for (size_t count = entries.blockCount; count > 0;) {
+                size_t half = count / 2;
+                if (entries.blockStart(k + half + 1) <= index) {
+                    k += half + 1;
+                    count -= half + 1;
+                } else {
+                    count = half;
+                }
+            }
+            Entries block;
+            if (k >= entries.blockCount || !this->block(entries, k, block)) {
+                return {};
+            }
+            index -= entries.blockStart(k);
+            entries = block;
+        }
+        const uint8_t* p = entries.table ? entries.at(index) : entries.first;
+        for (size_t i = 0; !entries.table && i < index && p; i++) {
+            p = skip(p, entries.end);
+        }
+        if (!p) {
+            return {};
+        }
+        return ConView(source, p, entries.end);
+    }
+
+    // a column of a columnar array (see CON_COLUMNAR), inflated if it was compressed, false if there is no such field
+    // it points into the file (or the inflated copy), so it stays valid as long as any view into the file
+    bool column(std::string_view key, ConColumn& column) const {
+        ConColumnLayout layout;
+        if (!this->layout(layout)) {
+            return false;
+        }
+        size_t field = layout.find(key);
+        return field < layout.keys.size() && this->column(layout.columns[field], layout.rows, column);
+    }
+
+    // the fields of a columnar array (see CON_COLUMNAR), false for anything else
+    bool layout(ConColumnLayout& layout) const {
+        Entries entries;
+        return type() == ConType::Array && this->entries(entries) && entries.columns && layout.read(format(), entries.columns, entries.end);
+    }
+
+    // the elements of a packed array (see CON_PACKED) as a column, inflated if it was compressed, false for anything else
+    // it points into the file (or the inflated copy), like column()
+    bool asColumn(ConColumn& column) const {
+        Entries entries;
+        return type() == ConType::Array && this->entries(entries) && entries.packed && packed(entries, column);
+    }
+
+    // number of blocks of an array split into blocks (see CON_BLOCKED), 0 for anything else
+    size_t blocks() const {
+        Entries entries;
+        return type() == ConType::Array && this->entries(entries) ? entries.blockCount : 0;
+    }
+
+    // index of the first element of block k, the block ends where block k + 1 starts (or with the array)
+    // reading elements of one block only inflates that block
+    size_t blockStart(size_t k) const {
+        Entries entries;
+        return type() == ConType::Array && this->entries(entries) && entries.blocks ? entries.blockStart(k) : 0;
+    }
+
+    // value of an object
+    ConView operator[](std::string_view key) const {
+        Entries entries;
+        if (type() != ConType::Object || !this->entries(entries)) {
+            return {};
+        }
+        Key wanted{key, 0};
+        if (format().has(CON_FLAG_KEY_DICTIONARY)) {
+            // keys that aren't in the dictionary aren't in any object, otherwise only indices have to be compared
+            const std::vector<std::string>& keys = format().keys;
+            auto it = std::lower_bound(keys.begin(), keys.end(), key);
+            if (it == keys.end() || *it != key) {
+                return {};
+            }
+            wanted.id = it - keys.begin();
+        }
+        if (entries.table) {
+            // keys are written in sorted order, with offsets we can binary search them
+            // with a key index most steps only have to look at the prefixes
+            uint64_t prefix = conKeyPrefix(key);
+            size_t low = 0;
+            size_t high = entries.count;
+            while (low < high) {
+                size_t middle = low + (high - low) / 2;
+                if (entries.index) {
+                    uint64_t current = entries.prefix(middle);
+                    if (current != prefix) {
+                        (current < prefix ? low = middle + 1 : high = middle);
+                        continue;
+                    }
+                }
+                const uint8_t* p = entries.at(middle);
+                int order;
+                if (!p || !compareKey(p, entries.end, wanted, order)) {
+                    return {};
+                }
+                if (order == 0) {
+                    return ConView(source, p, entries.end);
+                }
+                (order < 0 ? low = middle + 1 : high = middle);
+            }
+            return {};
+        }
+        // without tables the keys don't have to be sorted (see ConEventWriter), so every key is checked
+        const uint8_t* p = entries.first;
+        for (uint64_t i = 0; i < entries.count && p; i++) {
+            int order;
+            if (!compareKey(p, entries.end, wanted, order)) {
+                return {};
+            }
+            if (order == 0) {
+                return ConView(source, p, entries.end);
+            }
+            p = skip(p, entries.end);
+        }
+        return {};
+    }
+
+    // calls callback(key, value) for every entry of an object, or callback(index, value) for every element of an array
+    // returning false from the callback stops the iteration
+    template<typename Callback>
+    bool forEach(Callback&& callback) const {
+        constexpr bool byKey = std::is_invocable_v<Callback, std::string_view, const ConView&>;
+        constexpr bool byIndex = std::is_invocable_v<Callback, size_t, const ConView&>;
+        if (type() == ConType::Object ? !byKey : (type() != ConType::Array || !byIndex)) {
+            return false;
+        }
+        Entries entries;
+        if (!this->entries(entries)) {
+            return false;
+        }
+        bool more = true;
+        if (entries.columns) {
+            // every row is put together from the columns, see column() for reading one field without that
+            for (uint64_t i = 0; i < entries.count && more; i++) {
+                ConView value = row(entries, i);
+                if (!value) {
+                    return false;
+                }
+                if constexpr (byIndex) {
+                    more = callback((size_t)i, value);
+                }
+            }
+            return true;
+        } else if (entries.packed) {
+            // see asColumn() for scanning the values without a view for each of them
+            for (uint64_t i = 0; i < entries.count && more; i++) {
+                ConView value = element(entries, i);
+                if (!value) {
+                    return false;
+                }
+                if constexpr (byIndex) {
+                    more = callback((size_t)i, value);
+                }
+            }
+            return true;
+        }
+        if (!entries.blocks) {
+            return visit(entries, 0, callback, more);
+        }
+        // blocked arrays are walked block by block
+        for (size_t k = 0; k < entries.blockCount && more; k++) {
+            Entries block;
+            if (!this->block(entries, k, block) || !visit(block, entries.blockStart(k), callback, more)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // scalars, the fallback is returned if the value has a different type
+    bool asBoolean(bool fallback=false) const {
+        if (type() == ConType::Boolean && *pos != (uint8_t)ConType::Boolean) {
+            return *pos == CON_TAG_TRUE;
+        }
+        return scalar(ConType::Boolean, fallback);
+    }
+
+    int64_t asInteger(int64_t fallback=0) const {
+        if (type() != ConType::Integer) {
+            return fallback;
+        } else if (*pos >= CON_TAG_SMALL_INTEGER) {
+            return *pos & 0x7f;
+        } else if (compact()) {
+            const uint8_t* p = pos + 1;
+            uint64_t value;
+            return conReadVarint(p, end, value) ? conUnzigzag(value) : fallback;
+        }
+        return scalar(ConType::Integer, fallback);
+    }
+
+    double asFloat(double fallback=0.0) const {
+        return scalar(ConType::Float, fallback);
+    }
+
+    // points into the mapped file (or into the inflated copy for compressed strings)
+    std::string_view asString(std::string_view fallback={}) const {
+        Blob blob;
+        if (type() != ConType::String || !readBlob(blob)) {
+            return fallback;
+        }
+        return std::string_view((const char*)blob.begin, blob.end - blob.begin);
+    }
+
+    // decodes the whole subtree
+    ConValue decode(std::pmr::memory_resource* resource=std::pmr::get_default_resource()) const {
+        ConValue value;
+        if (valid()) {
+            ConMemoryBuffer buffer(pos, end - pos);
+            std::istream stream(&buffer);
+            ConReader reader{stream, format()};
+            value.read(reader, resource);
+        }
+        return value;
+    }
+
+private:
+    friend struct ConPatcher;
+
+    // the body of a string/array/object, inflated if it was compressed
+    struct Blob {
+        const uint8_t* begin;
+        const uint8_t* end;
+        // CON_BLOCKED, CON_COLUMNAR or CON_PACKED for arrays stored that way, 0 otherwise
+        uint8_t layout = 0;
+    };
+
+    // the elements of an array or the entries of an object
+    struct Entries {
+        uint64_t count;
+        // offset of every element, if the document has them
+        // with a key index every offset is preceded by the prefix of the key
+        const uint8_t* table = nullptr;
+        bool index = false;
+        const uint8_t* first;
+        const uint8_t* end;
+        // the block index of a blocked array, first points at the first block then
+        const uint8_t* blocks = nullptr;
+        uint64_t blockCount = 0;
+        // the payload of a columnar array, see ConColumnLayout
+        const uint8_t* columns = nullptr;
+        // the column of a packed array, after its count
+        const uint8_t* packed = nullptr;
+
+        const uint8_t* at(size_t i) const {
+            uint64_t offset;
+            memcpy(&offset, table + (index ? 2 * i + 1 : i) * sizeof(uint64_t), sizeof(uint64_t));
+            return offset < (uint64_t)(end - first) ? first + offset : nullptr;
+        }
+
+        uint64_t prefix(size_t i) const {
+            uint64_t prefix;
+            memcpy(&prefix, table + 2 * i * sizeof(uint64_t), sizeof(uint64_t));
+            return prefix;
+        }
+
+        // index of the first element of block k, count for k == blockCount
+        uint64_t blockStart(size_t k) const {
+            if (k >= blockCount) {
+                return count;
+            }
+            uint64_t start;
+            memcpy(&start, blocks + (2 * k + 1) * sizeof(uint64_t), sizeof(uint64_t));
+            return std::min(start, count);
+        }
+    };
+
+    // a reference to a shared subtree (see CON_FLAG_SHARED) views the subtree in the table instead
+    void resolve() {
+        uint64_t limit = UINT64_MAX;
+        while (pos && pos < end && *pos == CON_TAG_REFERENCE && format().has(CON_FLAG_SHARED)) {
+            const uint8_t* p = pos + 1;
+            uint64_t index;
+            size_t size;
+            const uint8_t* data = nullptr;
+            // subtrees only refer to the ones before them, so this can't loop forever
+            if (!readSize(p, end, index) || index >= limit || !(data = format().sharedValue(index, size))) {
+                pos = nullptr;
+                return;
+            }
+            limit = index;
+            pos = data;
+            end = data + size;
+        }
+    }
+
+    static ConView root(std::shared_ptr<ConViewSource> source) {
+        if (!source->format.read(source->data, source->size)) {
+            return {};
+        }
+        size_t header = source->format.headerSize();
+        if (source->size <= header) {
+            return {};
+        }
+        const uint8_t* begin = source->data + header;
+        const uint8_t* end = source->data + source->size;
+        return ConView(std::move(source), begin, end);
+    }
+
+    const ConFormat& format() const {
+        return source->format;
+    }
+
+    // whether the codec byte of an array says how it is laid out instead (see CON_BLOCKED, CON_COLUMNAR, CON_PACKED)
+    bool arrayLayout(ConType type, uint8_t compressed) const {
+        return type == ConType::Array && format().version >= 1 && (compressed == CON_BLOCKED || compressed == CON_COLUMNAR || compressed == CON_PACKED);
+    }
+
+    bool compact() const {
+        return format().has(CON_FLAG_COMPACT);
+    }
+
+    // sizes, counts and key lengths, see ConWriter::writeSize
+    bool readSize(const uint8_t*& p, const uint8_t* end, uint64_t& size) const {
+        return compact() ? conReadVarint(p, end, size) : readRaw(p, end, size);
+    }
+
+    template<typename T>
+    T scalar(ConType expected, T fallback) const {
+        if (type() != expected) {
+            return fallback;
+        }
+        const uint8_t* p = pos + 1;
+        T value;
+        return readRaw(p, end, value) ? value : fallback;
+    }
+
+    template<typename T>
+    static bool readRaw(const uint8_t*& p, const uint8_t* end, T& value) {
+        if ((size_t)(end - p) < sizeof(T)) {
+            return false;
+        }
+        memcpy(&value, p, sizeof(T));
+        p += sizeof(T);
+        return true;
+    }
+
+    // a key that is being looked up, id is its index in the key dictionary if there is one
+    struct Key {
+        std::string_view name;
+        uint64_t id;
+    };
+
+    // reads the key of the entry at p (moving p to its value) and compares it with `key`
+    bool compareKey(const uint8_t*& p, const uint8_t* end, const Key& key, int& order) const {
+        if (format().has(CON_FLAG_KEY_DICTIONARY)) {
+            uint64_t id;
+            if (!readSize(p, end, id)) {
+                return false;
+            }
+            order = id < key.id ? -1 : id > key.id ? 1 : 0;
+            return true;
+        }
+        std::string_view current;
+        if (!readKey(p, end, current)) {
+            return false;
+        }
+        order = current.compare(key.name);
+        return true;
+    }
+
+    bool readKey(const uint8_t*& p, const uint8_t* end, std::string_view& key) const {
+        uint64_t keySize;
+        if (format().has(CON_FLAG_KEY_DICTIONARY)) {
+            // the index of the key
+            if (!readSize(p, end, keySize) || keySize >= format().keys.size()) {
+                return false;
+            }
+            key = format().keys[keySize];
+            return true;
+        }
+        if (!readSize(p, end, keySize) || keySize > (uint64_t)(end - p)) {
+            return false;
+        }
+        key = std::string_view((const char*)p, keySize);
+        p += keySize;
+        return true;
+    }
+
+    // reads the codec and sizes in front of a string/array/object body
+    // `size` is the number of bytes stored, 0 if it isn't known (uncompressed version 0 arrays/objects)
+    // `rawSize` is the decompressed size, 0 if it isn't known (version 0)
+    bool readBlobHeader(const uint8_t*& p, const uint8_t* end, uint8_t& compressed, uint64_t& size, uint64_t& rawSize) const {
+        ConType type = (ConType)*p++;
+        size = 0;
+        rawSize = 0;
+        if (!readRaw(p, end, compressed)) {
+            return false;
+        }
+        bool sized = format().version >= 1 || compressed || type == ConType::String;
+        bool layout = arrayLayout(type, compressed);
+        // uncompressed (and blocked/columnar/packed) arrays/objects always have a fixed width size, see CON_FLAG_COMPACT
+        bool fixed = (!compressed || layout) && type != ConType::String;
+        if (sized && !(fixed ? readRaw(p, end, size) : readSize(p, end, size))) {
+            return false;
+        }
+        if (compressed && !layout && format().version >= 1) {
+            if (!readSize(p, end, rawSize)) {
+                return false;
+            }
+        }
+        return !sized || size <= (uint64_t)(end - p);
+    }
+
+    bool readBlob(Blob& blob) const {
+        const uint8_t* p = pos;
+        uint8_t compressed;
+        uint64_t size;
+        uint64_t rawSize;
+        if (!readBlobHeader(p, end, compressed, size, rawSize)) {
+            return false;
+        }
+        blob.layout = arrayLayout(type(), compressed) ? compressed : 0;
+        if (compressed && !blob.layout) {
+            const std::vector<uint8_t>& inflated = source->inflate(compressed, p, size, rawSize);
+            blob.begin = inflated.data();
+            blob.end = inflated.data() + inflated.size();
+        } else {
+            blob.begin = p;
+            // version 0 arrays/objects extend up to wherever their last value ends
+            blob.end = size || format().version >= 1 || type() == ConType::String ? p + size : end;
+        }
+        return true;
+    }
+
+    bool entries(Entries& entries) const {
+        Blob blob;
+        if ((type() != ConType::Array && type() != ConType::Object) || !readBlob(blob)) {
+            return false;
+        }
+        const uint8_t* p = blob.begin;
+        if (!readSize(p, blob.end, entries.count)) {
+            return false;
+        }
+        entries.blocks = nullptr;
+        entries.blockCount = 0;
+        entries.columns = nullptr;
+        entries.packed = nullptr;
+        entries.table = nullptr;
+        entries.end = blob.end;
+        if (blob.layout == CON_COLUMNAR) {
+            entries.columns = blob.begin;
+            entries.first = blob.end;
+            return true;
+        } else if (blob.layout == CON_PACKED) {
+            entries.packed = p;
+            entries.first = blob.end;
+            return true;
+        }
+        if (blob.layout == CON_BLOCKED) {
+            const size_t entrySize = 2 * sizeof(uint64_t);
+            if (!readSize(p, blob.end, entries.blockCount) || entries.blockCount > (uint64_t)(blob.end - p) / entrySize) {
+                return false;
+            }
+            entries.blocks = p;
+            p += entries.blockCount * entrySize;
+        }
+        entries.table = nullptr;
+        entries.index = type() == ConType::Object && format().has(CON_FLAG_KEY_INDEX);
+        if (!blob.layout && (entries.index || format().has(CON_FLAG_OFFSETS))) {
+            size_t entrySize = (entries.index ? 2 : 1) * sizeof(uint64_t);
+            if (entries.count > (uint64_t)(blob.end - p) / entrySize) {
+                return false;
+            }
+            entries.table = p;
+            p += entries.count * entrySize;
+        }
+        entries.first = p;
+        entries.end = blob.end;
+        return true;
+    }
+
+    // a stored column, inflated and expanded (both kept in the source) if it has to be
+    bool column(const ConColumnLayout::Column& stored, uint64_t rows, ConColumn& column) const {
+        const uint8_t* data = stored.data;
+        size_t size = stored.size;
+        if (stored.codec) {
+            const std::vector<uint8_t>& inflated = source->inflate(stored.codec, stored.data, stored.size, stored.rawSize);
+            data = inflated.data();
+            size = inflated.size();
+        }
+        if (stored.kind == CON_COLUMN_DELTA) {
+            const std::vector<uint8_t>& expanded = source->expand(stored.data, data, size, rows);
+            return !expanded.empty() && column.read((uint8_t)ConType::Integer, expanded.data(), expanded.size(), rows);
+        }
+        return column.read(stored.kind, data, size, rows);
+    }
+
+    // the column of a packed array
+    bool packed(const Entries& entries, ConColumn& column) const {
+        const uint8_t* p = entries.packed;
+        ConColumnLayout::Column stored;
+        return ConColumnLayout::readColumn(format(), p, entries.end, stored) && this->column(stored, entries.count, column);
+    }
+
+    // the value that was encoded for element `index` earlier, see keep()
+    ConView kept(size_t index) const {
+        std::lock_guard<std::mutex> lock(source->mutex);
+        auto it = source->rows.find({pos, index});
+        if (it == source->rows.end()) {
+            return {};
+        }
+        return ConView(source, it->second.data(), it->second.data() + it->second.size());
+    }
+
+    // encodes a value put together from columns, so it can be viewed like any other (and kept in the source)
+    ConView keep(size_t index, ConValue& value) const {
+        ConWriter writer;
+        writer.format.version = format().version;
+        writer.format.flags = format().flags;
+        writer.codec = nullptr;
+        writer.parent = &source->keys();
+        value.write(writer, 1);
+        std::lock_guard<std::mutex> lock(source->mutex);
+        std::vector<uint8_t>& encoded = source->rows.try_emplace({pos, index}, std::move(writer.buffer)).first->second;
+        return ConView(source, encoded.data(), encoded.data() + encoded.size());
+    }
+
+    // an element of a packed array
+    ConView element(const Entries& entries, size_t index) const {
+        if (ConView value = kept(index)) {
+            return value;
+        }
+        ConColumn column;
+        if (!packed(entries, column) || column.kind == CON_COLUMN_VALUES || index >= column.rows) {
+            return {};
+        }
+        ConValue value = column.cell(index, std::pmr::get_default_resource());
+        return keep(index, value);
+    }
+
+    // a row of a columnar array
+    ConView row(const Entries& entries, size_t index) const {
+        if (ConView value = kept(index)) {
+            return value;
+        }
+        ConColumnLayout layout;
+        if (!layout.read(format(), entries.columns, entries.end)) {
+            return {};
+        }
+        ConValue row = ConObject();
+        for (size_t field = 0; field < layout.columns.size(); field++) {
+            ConColumn column;
+            if (!this->column(layout.columns[field], layout.rows, column)) {
+                return {};
+            }
+            ConValue& cell = row.object->values.append(layout.keys[field]);
+            if (column.kind != CON_COLUMN_VALUES) {
+                cell = column.cell(index, std::pmr::get_default_resource());
+                continue;
+            }
+            const uint8_t* value = column.value(index);
+            if (!value) {
+                return {};
+            }
+            cell = ConView(source, value, column.end).decode();
+        }
+        row.object->values.sort();
+        return keep(index, row);
+    }
+
+    // the elements of block k of a blocked array, inflated if the block was compressed
+    bool block(const Entries& entries, size_t k, Entries& block) const {
+        uint64_t offset;
+        memcpy(&offset, entries.blocks + 2 * k * sizeof(uint64_t), sizeof(uint64_t));
+        uint64_t start = entries.blockStart(k);
+        uint64_t next = entries.blockStart(k + 1);
+        if (offset >= (uint64_t)(entries.end - entries.first) || start > next) {
+            return false;
+        }
+        const uint8_t* p = entries.first + offset;
+        uint8_t compressed = *p++;
+        uint64_t size;
+        uint64_t rawSize = 0;
+        if (!readSize(p, entries.end, size) || (compressed && !readSize(p, entries.end, rawSize)) || size > (uint64_t)(entries.end - p)) {
+            return false;
+        }
+        block = {};
+        block.count = next - start;
+        if (compressed) {
+            const std::vector<uint8_t>& inflated = source->inflate(compressed, p, size, rawSize);
+            block.first = inflated.data();
+            block.end = inflated.data() + inflated.size();
+        } else {
+            block.first = p;
+            block.end = p + size;
+        }
+        return true;
+    }
+
+    // calls `callback` for every element/entry, the indices continue from `base`
+    // false if the data is malformed, `more` is cleared once the callback wants to stop
+    template<typename Callback>
+    bool visit(const Entries& entries, size_t base, Callback& callback, bool& more) const {
+        constexpr bool byKey = std::is_invocable_v<Callback, std::string_view, const ConView&>;
+        constexpr bool byIndex = std::is_invocable_v<Callback, size_t, const ConView&>;
+        const uint8_t* p = entries.first;
+        for (uint64_t i = 0; i < entries.count && more; i++) {
+            std::string_view key;
+            if (type() == ConType::Object && !readKey(p, entries.end, key)) {
+                return false;
+            }
+            const uint8_t* next = skip(p, entries.end);
+            if (!next) {
+                return false;
+            }
+            ConView value(source, p, entries.end);
+            if constexpr (byKey && byIndex) {
+                more = type() == ConType::Object ? callback(key, value) : callback((size_t)(base + i), value);
+            } else if constexpr (byKey) {
+                more = callback(key, value);
+            } else {
+                more = callback((size_t)(base + i), value);
+            }
+            p = next;
+        }
+        return true;
+    }
+
+    // returns the position after the value at p, or nullptr if the data is malformed
+    const uint8_t* skip(const uint8_t* p, const uint8_t* end) const {
+        if (p >= end) {
+            return nullptr;
+        }
+        ConType type = (ConType)*p;
+        if (conTagType(*p) != type) {
+            // folded into the type byte
+            return p + 1;
+        } else if (*p == CON_TAG_REFERENCE && format().has(CON_FLAG_SHARED)) {
+            uint64_t index;
+            p++;
+            return readSize(p, end, index) ? p : nullptr;
+        }
+        switch (type) {
+            case ConType::Null:
+                return p + 1;
+            case ConType::Boolean:
+                return (size_t)(end - p) > sizeof(bool) ? p + 1 + sizeof(bool) : nullptr;
+            case ConType::Integer:
+                if (compact()) {
+                    uint64_t value;
+                    p++;
+                    return conReadVarint(p, end, value) ? p : nullptr;
+                }
+                return (size_t)(end - p) > sizeof(uint64_t) ? p + 1 + sizeof(uint64_t) : nullptr;
+            case ConType::Float:
+                return (size_t)(end - p) > sizeof(uint64_t) ? p + 1 + sizeof(uint64_t) : nullptr;
+            case ConType::String:
+            case ConType::Array:
+            case ConType::Object: {
+                uint8_t compressed;
+                uint64_t size;
+                uint64_t rawSize;
+                if (!readBlobHeader(p, end, compressed, size, rawSize)) {
+                    return nullptr;
+                }
+                if (format().version >= 1 || compressed || type == ConType::String) {
+                    return p + size;
+                }
+                // uncompressed version 0 payloads don't store their size, so we have to walk them
+                uint64_t count;
+                if (!readSize(p, end, count)) {
+                    return nullptr;
+                }
+                for (uint64_t i = 0; i < count && p; i++) {
+                    std::string_view key;
+                    if (type == ConType::Object && !readKey(p, end, key)) {
+                        return nullptr;
+                    }
+                    p = skip(p, end);
+                }
+                return p;
+            }
+            default:
+                return nullptr;
+        }
+    }
+};
+
+// the paths of a projection (see conSelect) as a tree, every node is a step that at least one path takes
+struct ConSelection {
+    // a path ends here, the whole value is selected
+    bool whole = false;
+    std::map<std::string, ConSelection, std::less<>> keys;
+    std::map<uint64_t, ConSelection> indices;
+    // [*], every element of an array
+    std::unique_ptr<ConSelection> elements;
+    // *, every entry of an object
+    std::unique_ptr<ConSelection> entries;
+
+    // keys are separated by dots, [n] is element n of an array, [*] every element and * every entry of an object
+    // e.g. "users[*].email", "meta.version", "rows[0].*", the empty path selects the whole value
+    bool add(std::string_view path) {
+        ConSelection* node = this;
+        size_t i = 0;
+        while (i < path.size()) {
+            if (path[i] == '[') {
+                size_t close = path.find(']', i);
+                if (close == std::string_view::npos || close == i + 1) {
+                    break;
+                }
+                std::string_view inside = path.substr(i + 1, close - i - 1);
+                if (inside == "*") {
+                    if (!node->elements) {
+                        node->elements = std::make_unique<ConSelection>();
+                    }
+                    node = node->elements.get();
+                } else {
+                    uint64_t index = 0;
+                    auto [end, error] = std::from_chars(inside.data(), inside.data() + inside.size(), index);
+                    if (error != std::errc() || end != inside.data() + inside.size()) {
+                        break;
+                    }
+                    node = &node->indices[index];
+                }
+                i = close + 1;
+                // a key after an index still needs its dot
+                if (i < path.size() && path[i] != '[' && path[i++] != '.') {
+                    break;
+                }
+                continue;
+            }
+            size_t next = path.find_first_of(".[", i);
+            std::string_view key = path.substr(i, next == std::string_view::npos ? std::string_view::npos : next - i);
+            if (key.empty()) {
+                break;
+            } else if (key == "*") {
+                if (!node->entries) {
+                    node->entries = std::make_unique<ConSelection>();
+                }
+                node = node->entries.get();
+            } else {
+                auto it = node->keys.find(key);
+                node = &(it != node->keys.end() ? it->second : node->keys.try_emplace(std::string(key)).first->second);
+            }
+            i = next == std::string_view::npos ? path.size() : next;
+            if (i < path.size() && path[i] == '.') {
+                i++;
+            }
+        }
+        // a path can't end with a dot either
+        if (i < path.size() || (!path.empty() && path.back() == '.')) {
+            ConLog() << "Invalid path: " << path;
+            return false;
+        }
+        node->whole = true;
+        return true;
+    }
+};
+
+// the projection of `view` on `selection`, every node applies to the value (more than one when wildcards and keys overlap)
+// false if the value can't have anything selected from it, because a path goes into a value that isn't a container
+bool conProject(const ConView& view, const std::vector<const ConSelection*>& nodes, ConValue& result, std::pmr::memory_resource* resource) {
+    for (const ConSelection* node : nodes) {
+        if (node->whole) {
+            result = view.decode(resource);
+            return true;
+        }
+    }
+    bool wildcard = false;
+    bool steps = false;
+    for (const ConSelection* node : nodes) {
+        wildcard |= view.type() == ConType::Object ? (bool)node->entries : (bool)node->elements;
+        steps |= view.type() == ConType::Object ? !node->keys.empty() : !node->indices.empty();
+    }
+    if (!wildcard && !steps) {
+        // the paths expect another type here
+        return false;
+    }
+    if (view.type() == ConType::Object) {
+        result = ConObject(resource);
+        ConEntries& values = result.object->values;
+        if (!wildcard) {
+            // only the selected keys are looked up, everything else is never touched
+            std::map<std::string_view, std::vector<const ConSelection*>> groups;
+            for (const ConSelection* node : nodes) {
+                for (auto& [key, child] : node->keys) {
+                    groups[key].push_back(&child);
+                }
+            }
+            for (auto& [key, group] : groups) {
+                ConValue value;
+                if (ConView child = view[key]; child && conProject(child, group, value, resource)) {
+                    values.append(key) = std::move(value);
+                }
+            }
+            return true;
+        }
+        bool ok = view.forEach([&](std::string_view key, const ConView& child) {
+            std::vector<const ConSelection*> group;
+            for (const ConSelection* node : nodes) {
+                if (node->entries) {
+                    group.push_back(node->entries.get());
+                }
+                if (auto it = node->keys.find(key); it != node->keys.end()) {
+                    group.push_back(&it->second);
+                }
+            }
+            ConValue value;
+            if (conProject(child, group, value, resource)) {
+                values.append(key) = std::move(value);
+            }
+            return true;
+        });
+        // documents that were streamed don't have to be sorted, see ConEventWriter
+        values.sort();
+        return ok;
+    }
+    if (view.type() != ConType::Array) {
+        return false;
+    }
+    result = ConArray(resource);
+    std::pmr::vector<ConValue>& values = result.array->values;
+    auto select = [&](size_t index, const ConView& child) {
+        std::vector<const ConSelection*> group;
+        for (const ConSelection* node : nodes) {
+            if (node->elements) {
+                group.push_back(node->elements.get());
+            }
+            if (auto it = node->indices.find(index); it != node->indices.end()) {
+                group.push_back(&it->second);
+            }
+        }
+        ConValue value;
+        if (conProject(child, group, value, resource)) {
+            values.push_back(std::move(value));
+        }
+        return true;
+    };
+    if (!wildcard) {
+        // the selected elements, in the order of their indices
+        std::map<uint64_t, bool> indices;
+        for (const ConSelection* node : nodes) {
+            for (auto& [index, child] : node->indices) {
+                indices[index] = true;
+            }
+        }
+        for (auto& [index, unused] : indices) {
+            if (ConView child = view[index]) {
+                select(index, child);
+            }
+        }
+        return true;
+    }
+    // the elements of a columnar array only ever get keys selected from them (without indices or wildcards),
+    // so only the columns of those keys are read, instead of putting every row together
+    ConColumnLayout layout;
+    bool keysOnly = true;
+    for (const ConSelection* node : nodes) {
+        // nodes without elements or indices expect an object, they don't select anything here
+        keysOnly &= node->indices.empty() && (!node->elements || (!node->elements->whole && !node->elements->entries && !node->elements->elements && node->elements->indices.empty()));
+    }
+    if (!keysOnly || !view.layout(layout)) {
+        return view.forEach(select);
+    }
+    values.reserve(layout.rows);
+    for (uint64_t i = 0; i < layout.rows; i++) {
+        values.emplace_back(ConObject(resource));
+    }
+    std::map<std::string_view, std::vector<const ConSelection*>> groups;
+    for (const ConSelection* node : nodes) {
+        if (!node->elements) {
+            continue;
+        }
+        for (auto& [key, child] : node->elements->keys) {
+            groups[key].push_back(&child);
+        }
+    }
+    for (auto& [key, group] : groups) {
+        ConColumn column;
+        if (!view.column(key, column)) {
+            continue;
+        }
+        bool whole = std::any_of(group.begin(), group.end(), [](const ConSelection* node) { return node->whole; });
+        for (uint64_t i = 0; i < layout.rows; i++) {
+            ConValue value;
+            if (column.kind == CON_COLUMN_VALUES) {
+                const uint8_t* p = column.value(i);
+                if (!p || !conProject(ConView(view.source, p, column.end), group, value, resource)) {
+                    continue;
+                }
+            } else if (whole) {
+                value = column.cell(i, resource);
+            } else {
+                continue;
+            }
+            values[i].object->values.append(key) = std::move(value);
+        }
+    }
+    // the fields of a columnar array don't have to be sorted if it wasn't written by this library
+    for (ConValue& row : values) {
+        row.object->values.sort();
+    }
+    return true;
+}
+
+// decodes only the parts of `view` that any of `paths` selects (see ConSelection::add for the syntax),
+// keeping the shape of the document, e.g. {"users": [{"email": ...}, ...], "meta": {"version": ...}}
+// subtrees no path goes into are skipped without being decoded, and inflated only if they are on the way
+// selected array elements are kept in order (indices aren't kept), missing keys are left out
+// false if a path is invalid or the view is
+bool conSelect(const ConView& view, const std::vector<std::string_view>& paths, ConValue& result, std::pmr::memory_resource* resource=std::pmr::get_default_resource()) {
+    ConSelection selection;
+    for (std::string_view path : paths) {
+        if (!selection.add(path)) {
+            return false;
+        }
+    }
+    result = ConValue();
+    if (!view) {
+        return false;
+    }
+    conProject(view, {&selection}, result, resource);
+    return true;
+}